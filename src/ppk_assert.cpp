@@ -9,15 +9,67 @@
 
 #include <ppk_assert.h>
 
+#include <cstddef> // offsetof()
 #include <cstdio>  // fprintf() and vsnprintf()
 #include <cstring>
 #include <cstdarg> // va_start() and va_end()
 #include <cstdlib> // abort()
+#include <ctime>   // time()
+
+#if defined(_MSC_VER)
+#include <intrin.h> // _InterlockedCompareExchange() and friends
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)) && !defined(PPK_ASSERT_DISABLE_TSC)
+#if !defined(_MSC_VER)
+#include <x86intrin.h> // __rdtsc()
+#include <cpuid.h>     // __get_cpuid()
+#endif
+#define PPK_ASSERT_HAVE_TSC
+#endif
+
+#if defined(_WIN32)
+#include <io.h> // _isatty()
+#endif
 
 #if defined(__APPLE__)
 #include <TargetConditionals.h>
 #endif
 
+#if defined(__GNUC__) || defined(__clang__)
+#include <cxxabi.h> // abi::__cxa_demangle()
+#endif
+
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h> // backtrace()
+#include <dlfcn.h>    // dladdr()
+#define PPK_ASSERT_HAVE_BACKTRACE
+#endif
+
+#if !defined(_WIN32)
+#include <fcntl.h>    // open()
+#include <sys/file.h> // flock()
+#include <sys/mman.h> // mmap()
+#include <sys/stat.h> // fstat(), lstat()
+#include <unistd.h>   // ftruncate() and close()
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>   // kill()
+#include <sys/time.h> // struct timeval
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <strings.h>  // strcasecmp()
+#include <netinet/in.h>
+#include <netdb.h>        // getaddrinfo()
+#if defined(__linux__)
+#include <sys/syscall.h> // SYS_gettid
+#endif
+#if !defined(__ANDROID__) && !defined(ANDROID)
+#define PPK_ASSERT_HAVE_SHM
+#endif
+#endif
+
 #if defined(__ANDROID__) || defined(ANDROID)
 #include <android/log.h>
 #if !defined(PPK_ASSERT_LOG_TAG)
@@ -33,6 +85,8 @@
 // However, no memory allocation happens if
 // PPK_ASSERT_EXCEPTION_MESSAGE_BUFFER_SIZE == PPK_ASSERT_MESSAGE_BUFFER_SIZE
 // which is the default.
+// AssertionException::stackTrace() also allocates the symbolized stack, and
+// subscribe() / unsubscribe() allocate the list of subscribers.
 #if !defined(PPK_ASSERT_MALLOC)
 #define PPK_ASSERT_MALLOC(size) malloc(size)
 #endif
@@ -49,10 +103,88 @@
 #define PPK_ASSERT_ABORT abort
 #endif
 
+// number of innermost breadcrumbs appended to the message of failed
+// assertions, see PPK_ASSERT_CONTEXT()
+#if !defined(PPK_ASSERT_BREADCRUMB_DEPTH)
+#define PPK_ASSERT_BREADCRUMB_DEPTH 8
+#endif
+
+// the site table keeps track of every assertion that failed at least once, it
+// has a fixed capacity which must be a power of 2
+#if !defined(PPK_ASSERT_SITE_TABLE_SIZE)
+#define PPK_ASSERT_SITE_TABLE_SIZE 256
+#endif
+
+//#define PPK_ASSERT_HEAVY_HITTERS 8
+
+// the metrics exporter renders into a static buffer of that size, the text
+// is cut at the last complete line when it doesn't fit
+#if !defined(PPK_ASSERT_METRICS_BUFFER_SIZE)
+#define PPK_ASSERT_METRICS_BUFFER_SIZE 65536
+#endif
+
+// maximum size of the UDP datagrams sent to the StatsD agent, the default
+// fits in a 1500 bytes Ethernet MTU
+#if !defined(PPK_ASSERT_STATSD_DATAGRAM_SIZE)
+#define PPK_ASSERT_STATSD_DATAGRAM_SIZE 1432
+#endif
+
+// number of events the event shipper keeps while the collector is
+// unreachable, must be a power of 2
+#if !defined(PPK_ASSERT_SHIPPER_QUEUE_SIZE)
+#define PPK_ASSERT_SHIPPER_QUEUE_SIZE 256
+#endif
+
+// reconnection attempts back off exponentially up to that delay, in
+// milliseconds
+#if !defined(PPK_ASSERT_SHIPPER_MAX_BACKOFF)
+#define PPK_ASSERT_SHIPPER_MAX_BACKOFF 30000
+#endif
+
+// number of events waiting for the async dispatch worker, must be a power of 2
+#if !defined(PPK_ASSERT_DISPATCH_QUEUE_SIZE)
+#define PPK_ASSERT_DISPATCH_QUEUE_SIZE 256
+#endif
+
+// number of levels given their own async dispatch policy
+#if !defined(PPK_ASSERT_DISPATCH_POLICIES)
+#define PPK_ASSERT_DISPATCH_POLICIES 8
+#endif
+
+// number of failed assertions kept by the flight recorder, must be a power of
+// 2
+#if !defined(PPK_ASSERT_FLIGHT_RECORDER_SIZE)
+#define PPK_ASSERT_FLIGHT_RECORDER_SIZE 64
+#endif
+
+// number of distinct stacks counted, and of distinct program counters whose
+// symbol is cached in an arena of PPK_ASSERT_SYMBOL_ARENA_SIZE bytes, table
+// sizes must be powers of 2
+#if !defined(PPK_ASSERT_STACK_TABLE_SIZE)
+#define PPK_ASSERT_STACK_TABLE_SIZE 256
+#endif
+
+#if !defined(PPK_ASSERT_SYMBOL_CACHE_SIZE)
+#define PPK_ASSERT_SYMBOL_CACHE_SIZE 1024
+#endif
+
+#if !defined(PPK_ASSERT_SYMBOL_ARENA_SIZE)
+#define PPK_ASSERT_SYMBOL_ARENA_SIZE 65536
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PPK_ASSERT_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define PPK_ASSERT_NOINLINE __declspec(noinline)
+#else
+#define PPK_ASSERT_NOINLINE
+#endif
+
 namespace {
 
   namespace AssertLevel = ppk::assert::implementation::AssertLevel;
   namespace AssertAction = ppk::assert::implementation::AssertAction;
+  namespace AssertStage = ppk::assert::implementation::AssertStage;
 
   typedef int (*printHandler)(FILE* out, int, const char* format, ...);
 
@@ -127,28 +259,27 @@ namespace {
     return count;
   }
 
-  int formatLevel(int level, const char* expression, FILE* out, printHandler print)
+  const char* levelString(int level)
   {
-    const char* levelstr = 0;
-
     switch (level)
     {
       case AssertLevel::Debug:
-        levelstr = "DEBUG";
-        break;
+        return "DEBUG";
       case AssertLevel::Warning:
-        levelstr = "WARNING";
-        break;
+        return "WARNING";
       case AssertLevel::Error:
-        levelstr = "ERROR";
-        break;
+        return "ERROR";
       case AssertLevel::Fatal:
-        levelstr = "FATAL";
-        break;
+        return "FATAL";
 
       default:
-        break;
+        return 0;
     }
+  }
+
+  int formatLevel(int level, const char* expression, FILE* out, printHandler print)
+  {
+    const char* levelstr = levelString(level);
 
     if (levelstr)
       return print(out, level, "Assertion '%s' failed (%s)\n", expression, levelstr);
@@ -156,279 +287,4427 @@ namespace {
       return print(out, level, "Assertion '%s' failed (level = %d)\n", expression, level);
   }
 
-  AssertAction::AssertAction PPK_ASSERT_CALL _defaultHandler( const char* file,
-                                                              int line,
-                                                              const char* function,
-                                                              const char* expression,
-                                                              int level,
-                                                              const char* message)
+  // atomics are only ever used on the failure path, we don't bother with
+  // anything weaker than acquire / release semantics
+  long atomicLoad(const volatile long* p)
   {
-#if defined(_WIN32)
-    if (::GetConsoleWindow() == NULL)
-    {
-      if (::AllocConsole())
-      {
-        (void)freopen("CONIN$", "r", stdin);
-        (void)freopen("CONOUT$", "w", stdout);
-        (void)freopen("CONOUT$", "w", stderr);
-
-        SetFocus(::GetConsoleWindow());
-      }
-    }
+#if defined(_MSC_VER)
+    return _InterlockedCompareExchange(const_cast<volatile long*>(p), 0, 0);
+#else
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
 #endif
+  }
 
-    formatLevel(level, expression, stderr, reinterpret_cast<printHandler>(print));
-    print(stderr, level, "  in file %s, line %d\n  function: %s\n", file, line, function);
+  void atomicStore(volatile long* p, long value)
+  {
+#if defined(_MSC_VER)
+    _InterlockedExchange(p, value);
+#else
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+#endif
+  }
 
-    if (message)
-      print(stderr, level, "  with message: %s\n\n", message);
+  // see lineIgnored()
+  void storeLineIgnored(bool* ignoreLine, bool value)
+  {
+#if defined(_MSC_VER)
+    *static_cast<volatile bool*>(ignoreLine) = value;
+#else
+    __atomic_store_n(ignoreLine, value, __ATOMIC_RELAXED);
+#endif
+  }
 
-    if (level < AssertLevel::Debug)
-    {
-      return AssertAction::None;
-    }
-    else if (AssertLevel::Debug <= level && level < AssertLevel::Error)
-    {
-#if (!TARGET_OS_IPHONE && !TARGET_IPHONE_SIMULATOR) && (!defined(__ANDROID__) && !defined(ANDROID)) || defined(PPK_ASSERT_DEFAULT_HANDLER_STDIN)
-      for (;;)
-      {
-#if defined(PPK_ASSERT_DISABLE_IGNORE_LINE)
-        fprintf(stderr, "Press (I)gnore / Ignore (A)ll / (D)ebug / A(b)ort: ");
+  long atomicAdd(volatile long* p, long value)
+  {
+#if defined(_MSC_VER)
+    return _InterlockedExchangeAdd(p, value) + value;
 #else
-        fprintf(stderr, "Press (I)gnore / Ignore (F)orever / Ignore (A)ll / (D)ebug / A(b)ort: ");
+    return __atomic_add_fetch(p, value, __ATOMIC_SEQ_CST);
 #endif
-        fflush(stderr);
+  }
 
-        char buffer[256];
-        if (!fgets(buffer, sizeof(buffer), stdin))
-        {
-          clearerr(stdin);
-          fprintf(stderr, "\n");
-          fflush(stderr);
-          continue;
-        }
+  bool atomicCompareExchange(volatile long* p, long expected, long desired)
+  {
+#if defined(_MSC_VER)
+    return _InterlockedCompareExchange(p, desired, expected) == expected;
+#else
+    return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+  }
 
-        // we eventually skip the leading spaces but that's it
-        char input[2] = {'b', 0};
-        if (sscanf(buffer, " %1[a-zA-Z] ", input) != 1)
-          continue;
+  int64_t atomicLoad64(const volatile int64_t* p)
+  {
+#if defined(_MSC_VER)
+    return InterlockedCompareExchange64(const_cast<volatile int64_t*>(p), 0, 0);
+#else
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+  }
 
-        switch (*input)
-        {
-          case 'b':
-          case 'B':
-            return AssertAction::Abort;
+  void atomicStore64(volatile int64_t* p, int64_t value)
+  {
+#if defined(_MSC_VER)
+    InterlockedExchange64(p, value);
+#else
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+#endif
+  }
 
-          case 'd':
-          case 'D':
-            return AssertAction::Break;
+  int64_t atomicAdd64(volatile int64_t* p, int64_t value)
+  {
+#if defined(_MSC_VER)
+    return InterlockedExchangeAdd64(p, value) + value;
+#else
+    return __atomic_add_fetch(p, value, __ATOMIC_SEQ_CST);
+#endif
+  }
 
-          case 'i':
-          case 'I':
-            return AssertAction::Ignore;
+  void atomicMax64(volatile int64_t* p, int64_t value)
+  {
+    for (int64_t current = atomicLoad64(p); current < value; current = atomicLoad64(p))
+    {
+#if defined(_MSC_VER)
+      if (InterlockedCompareExchange64(p, value, current) == current)
+        break;
+#else
+      if (__atomic_compare_exchange_n(p, &current, value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        break;
+#endif
+    }
+  }
 
-#  if !defined(PPK_ASSERT_DISABLE_IGNORE_LINE)
-          case 'f':
-          case 'F':
-            return AssertAction::IgnoreLine;
-#  endif
+  template<typename T>
+  T atomicLoadPointer(T const volatile* p)
+  {
+#if defined(_MSC_VER)
+    return *p; // volatile accesses have acquire / release semantics
+#else
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+  }
 
-          case 'a':
-          case 'A':
-            return AssertAction::IgnoreAll;
+  template<typename T>
+  void atomicStorePointer(T volatile* p, T value)
+  {
+#if defined(_MSC_VER)
+    *p = value;
+    MemoryBarrier();
+#else
+    __atomic_store_n(p, value, __ATOMIC_SEQ_CST);
+#endif
+  }
 
-          default:
-            break;
-        }
-      }
+  void yieldThread()
+  {
+#if defined(_WIN32)
+    ::Sleep(0);
 #else
-      return AssertAction::Break;
+    usleep(100);
 #endif
+  }
+
+  class SpinLock
+  {
+    public:
+    explicit SpinLock(volatile long* lock)
+    : _lock(lock)
+    {
+      while (!atomicCompareExchange(_lock, 0, 1))
+        ;
     }
-    else if (AssertLevel::Error <= level && level < AssertLevel::Fatal)
+
+    ~SpinLock()
     {
-      return AssertAction::Throw;
+      atomicStore(_lock, 0);
     }
 
-    return AssertAction::Abort;
+    private:
+    SpinLock(const SpinLock&);
+    SpinLock& operator = (const SpinLock&);
+
+    volatile long* _lock;
+  };
+
+  unsigned long hashString(unsigned long hash, const char* s)
+  {
+    // FNV-1a
+    for (; s && *s; ++s)
+      hash = (hash ^ static_cast<unsigned char>(*s)) * 16777619ul;
+
+    return hash & 0xfffffffful;
   }
 
-  void _throw(const char* file,
-              int line,
-              const char* function,
-              const char* expression,
-              const char* message)
+  unsigned long hashSite(const char* file, int line, const char* expression)
   {
-    using ppk::assert::implementation::throwException;
-    throwException(ppk::assert::AssertionException(file, line, function, expression, message));
+    unsigned long hash = hashString(2166136261ul, file);
+    hash = (hash ^ static_cast<unsigned long>(line)) * 16777619ul;
+    hash = hashString(hash, expression);
+
+    return hash ? hash : 1; // 0 marks an empty slot
   }
-}
 
-namespace ppk {
-namespace assert {
+#if defined(PPK_ASSERT_HEAVY_HITTERS)
+  PPK_STATIC_ASSERT(PPK_ASSERT_HEAVY_HITTERS >= 2, "PPK_ASSERT_HEAVY_HITTERS must be at least 2");
 
-  AssertionException::AssertionException(const char* file,
-                                         int line,
-                                         const char* function,
-                                         const char* expression,
-                                         const char* message)
-  : _file(file), _line(line), _function(function), _expression(expression), _heap(PPK_ASSERT_NULLPTR)
+  struct HeavyHitterCounter
   {
-    if (!message)
-    {
-      memset(_stack, 0, sizeof(char) * size);
-      return;
-    }
+    unsigned long fingerprint;
+    unsigned long count;
+    unsigned long error;
+    char message[PPK_ASSERT_HEAVY_HITTER_MESSAGE_SIZE];
+  };
+#endif
 
-    size_t length = strlen(message);
+  struct Site
+  {
+    volatile long ready;
+    unsigned long hash;
+    const char* file;
+    int line;
+    const char* function;
+    const char* expression;
+    int level;
+    bool* ignoreLine;
+    long ordinal; // order in which sites failed for the first time
+    volatile long muted;
+    bool mutedLine; // muting set *ignoreLine, only accessed by the admin server
+    volatile long failures;
+    volatile long suppressed;
+    volatile long ignored;
+    volatile long thrown;
+    long statsdSent; // failures already sent to the StatsD agent
 
-    if (length < size) // message is short enough for the stack buffer
+#if defined(PPK_ASSERT_HEAVY_HITTERS)
+    volatile long lock;
+    HeavyHitterCounter hitters[PPK_ASSERT_HEAVY_HITTERS];
+#endif
+  };
+
+  PPK_STATIC_ASSERT((PPK_ASSERT_SITE_TABLE_SIZE & (PPK_ASSERT_SITE_TABLE_SIZE - 1)) == 0, "PPK_ASSERT_SITE_TABLE_SIZE must be a power of 2");
+
+  Site _sites[PPK_ASSERT_SITE_TABLE_SIZE];
+  volatile long _sitesLock = 0;
+  long _siteCount = 0;
+
+  volatile long _levelThreshold = 0;
+
+  bool matchSite(const Site& site, unsigned long hash, const char* file, int line, const char* expression)
+  {
+    return site.hash == hash && site.line == line && strcmp(site.file, file) == 0 && strcmp(site.expression, expression) == 0;
+  }
+
+  // lock-free lookup, slots are published once fully initialized
+  Site* findSite(unsigned long hash, const char* file, int line, const char* expression)
+  {
+    for (unsigned long i = 0; i < PPK_ASSERT_SITE_TABLE_SIZE; ++i)
     {
-      memcpy(_stack, message, sizeof(char) * length);
-      memset(_stack + length, 0, sizeof(char) * (size - length)); // pad with 0
+      Site& site = _sites[(hash + i) & (PPK_ASSERT_SITE_TABLE_SIZE - 1)];
+
+      if (!atomicLoad(&site.ready))
+        return PPK_ASSERT_NULLPTR;
+
+      if (matchSite(site, hash, file, line, expression))
+        return &site;
     }
-    else // allocate storage on the heap
+
+    return PPK_ASSERT_NULLPTR;
+  }
+
+  // returns null when the table is full
+  Site* acquireSite(const char* file, int line, const char* function, const char* expression, int level, bool* ignoreLine)
+  {
+    unsigned long hash = hashSite(file, line, expression);
+
+    if (Site* site = findSite(hash, file, line, expression))
+      return site;
+
+    SpinLock lock(&_sitesLock);
+
+    for (unsigned long i = 0; i < PPK_ASSERT_SITE_TABLE_SIZE; ++i)
     {
-      _heap = static_cast<char*>(PPK_ASSERT_MALLOC(sizeof(char) * (length + 1)));
+      Site& site = _sites[(hash + i) & (PPK_ASSERT_SITE_TABLE_SIZE - 1)];
 
-      if (!_heap) // allocation failed
-      {
-        memcpy(_stack, message, sizeof(char) * (size - 1)); // stack fallback, truncate :/
-        _stack[size - 1] = 0;
-      }
-      else
+      if (site.ready)
       {
-        memcpy(_heap, message, sizeof(char) * length); // copy the message
-        _heap[length] = 0;
-        _stack[size - 1] = 1; // mark the stack
+        if (matchSite(site, hash, file, line, expression))
+          return &site;
+
+        continue;
       }
+
+      site.hash = hash;
+      site.file = file;
+      site.line = line;
+      site.function = function;
+      site.expression = expression;
+      site.level = level;
+      site.ignoreLine = ignoreLine;
+      site.ordinal = _siteCount++;
+      atomicStore(&site.ready, 1);
+
+      return &site;
     }
+
+    return PPK_ASSERT_NULLPTR;
   }
 
-  AssertionException::AssertionException(const AssertionException& rhs)
-  : _file(rhs._file), _line(rhs._line), _function(rhs._function), _expression(rhs._expression)
+#if defined(PPK_ASSERT_HEAVY_HITTERS)
+  // masks numbers, including hexadecimal and decimal ones, so that messages
+  // only differing by ids or values share the same fingerprint
+  unsigned long fingerprintMessage(const char* message, char* normalized, size_t size)
   {
-    const char* message = rhs.what();
-    size_t length = strlen(message);
+    unsigned long hash = 2166136261ul;
+    size_t length = 0;
 
-    if (length < size) // message is short enough for the stack buffer
-    {
-      memcpy(_stack, message, sizeof(char) * size); // pad with 0
-    }
-    else // allocate storage on the heap
+    for (const char* p = message; *p;)
     {
-      _heap = static_cast<char*>(PPK_ASSERT_MALLOC(sizeof(char) * (length + 1)));
+      char c = *p++;
 
-      if (!_heap) // allocation failed
+      if (c >= '0' && c <= '9')
       {
-        memcpy(_stack, message, sizeof(char) * (size - 1)); // stack fallback, truncate :/
+        while ((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f') || (*p >= 'A' && *p <= 'F') || *p == 'x' || *p == 'X' || (*p == '.' && p[1] >= '0' && p[1] <= '9'))
+          ++p;
+
+        c = '#';
+      }
+
+      hash = ((hash ^ static_cast<unsigned char>(c)) * 16777619ul) & 0xfffffffful;
+
+      if (length + 1 < size)
+        normalized[length++] = c;
+    }
+
+    normalized[length] = 0;
+
+    return hash;
+  }
+
+  // space-saving algorithm (Metwally et al.): when the sketch is full, the
+  // least frequent entry is evicted and its count is inherited as error
+  void recordHeavyHitter(Site& site, const char* message)
+  {
+    if (!message)
+      return;
+
+    char normalized[PPK_ASSERT_HEAVY_HITTER_MESSAGE_SIZE];
+    unsigned long fingerprint = fingerprintMessage(message, normalized, sizeof(normalized));
+
+    SpinLock lock(&site.lock);
+
+    HeavyHitterCounter* min = &site.hitters[0];
+
+    for (int i = 0; i < PPK_ASSERT_HEAVY_HITTERS; ++i)
+    {
+      HeavyHitterCounter& counter = site.hitters[i];
+
+      if (counter.count && counter.fingerprint == fingerprint)
+      {
+        ++counter.count;
+        return;
+      }
+
+      if (counter.count < min->count)
+        min = &counter;
+    }
+
+    min->error = min->count;
+    min->count = min->count + 1;
+    min->fingerprint = fingerprint;
+    memcpy(min->message, normalized, sizeof(normalized));
+  }
+
+  int collectHeavyHitters(Site& site, ppk::assert::implementation::HeavyHitter* hitters, int count)
+  {
+    HeavyHitterCounter sorted[PPK_ASSERT_HEAVY_HITTERS];
+    int n = 0;
+
+    {
+      SpinLock lock(&site.lock);
+
+      // insertion sort, by decreasing count
+      for (int i = 0; i < PPK_ASSERT_HEAVY_HITTERS; ++i)
+      {
+        if (!site.hitters[i].count)
+          continue;
+
+        int j = n++;
+        for (; j > 0 && sorted[j - 1].count < site.hitters[i].count; --j)
+          sorted[j] = sorted[j - 1];
+
+        sorted[j] = site.hitters[i];
+      }
+    }
+
+    if (n > count)
+      n = count;
+
+    for (int i = 0; i < n; ++i)
+    {
+      hitters[i].count = sorted[i].count;
+      hitters[i].error = sorted[i].error;
+      memcpy(hitters[i].message, sorted[i].message, sizeof(sorted[i].message));
+    }
+
+    return n;
+  }
+
+  void printHeavyHitters(Site& site, int level, const char* indent)
+  {
+    ppk::assert::implementation::HeavyHitter hitters[PPK_ASSERT_HEAVY_HITTERS];
+    int count = collectHeavyHitters(site, hitters, PPK_ASSERT_HEAVY_HITTERS);
+
+    for (int i = 0; i < count; ++i)
+      print(stderr, level, "%s%lu x %s\n", indent, hitters[i].count, hitters[i].message);
+  }
+#endif
+
+  namespace implementation = ppk::assert::implementation;
+
+  // renders the metrics and the breadcrumbs, keeps counting past the end of
+  // the buffer like snprintf() does
+  struct TextWriter
+  {
+    char* buffer;
+    size_t size;
+    size_t length;
+  };
+
+  void writeChar(TextWriter& writer, char c)
+  {
+    if (writer.length + 1 < writer.size)
+      writer.buffer[writer.length] = c;
+
+    ++writer.length;
+  }
+
+  void writeFormat(TextWriter& writer, const char* format, ...)
+  {
+    char* p = writer.length < writer.size ? writer.buffer + writer.length : PPK_ASSERT_NULLPTR;
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintf(p, p ? writer.size - writer.length : 0, format, args);
+    va_end(args);
+
+    if (length > 0)
+      writer.length += static_cast<size_t>(length);
+  }
+
+  // renders one conversion of a breadcrumb with the type its argument was
+  // captured with, so that a mismatched format can't read garbage
+  void writeBreadcrumbArgument(TextWriter& writer, const char* spec, char conversion, const implementation::BreadcrumbArgument* argument)
+  {
+    typedef implementation::BreadcrumbArgument Argument;
+
+    char format[32];
+
+    if (!argument)
+    {
+      writeFormat(writer, "?");
+      return;
+    }
+
+    switch (conversion)
+    {
+      case 'd':
+      case 'i':
+        snprintf(format, sizeof(format), "%slld", spec);
+        writeFormat(writer, format, static_cast<implementation::LongLong>(argument->type == Argument::Signed ? argument->value.i
+                                  : argument->type == Argument::Unsigned ? static_cast<int64_t>(argument->value.u)
+                                  : argument->type == Argument::Floating ? static_cast<int64_t>(argument->value.d) : 0));
+        break;
+
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+        snprintf(format, sizeof(format), "%sll%c", spec, conversion);
+        writeFormat(writer, format, static_cast<implementation::UnsignedLongLong>(argument->type == Argument::Unsigned ? argument->value.u
+                                  : argument->type == Argument::Signed ? static_cast<uint64_t>(argument->value.i)
+                                  : argument->type == Argument::Floating ? static_cast<uint64_t>(argument->value.d) : 0));
+        break;
+
+      case 'c':
+        snprintf(format, sizeof(format), "%sc", spec);
+        writeFormat(writer, format, argument->type == Argument::Signed ? static_cast<int>(argument->value.i)
+                                  : argument->type == Argument::Unsigned ? static_cast<int>(argument->value.u) : '?');
+        break;
+
+      case 'e':
+      case 'E':
+      case 'f':
+      case 'F':
+      case 'g':
+      case 'G':
+        snprintf(format, sizeof(format), "%s%c", spec, conversion);
+        writeFormat(writer, format, argument->type == Argument::Floating ? argument->value.d
+                                  : argument->type == Argument::Signed ? static_cast<double>(argument->value.i)
+                                  : argument->type == Argument::Unsigned ? static_cast<double>(argument->value.u) : 0.0);
+        break;
+
+      case 's':
+        snprintf(format, sizeof(format), "%ss", spec);
+        writeFormat(writer, format, argument->type != Argument::String ? "?" : argument->value.s ? argument->value.s : "(null)");
+        break;
+
+      case 'p':
+        snprintf(format, sizeof(format), "%sp", spec);
+        writeFormat(writer, format, argument->type == Argument::Pointer ? argument->value.p
+                                  : argument->type == Argument::String ? static_cast<const void*>(argument->value.s) : PPK_ASSERT_NULLPTR);
+        break;
+    }
+  }
+
+  void writeBreadcrumb(TextWriter& writer, const implementation::Breadcrumb& breadcrumb)
+  {
+    const char* p = breadcrumb.format();
+    int index = 0;
+
+    while (*p)
+    {
+      const char* percent = strchr(p, '%');
+      size_t length = percent ? static_cast<size_t>(percent - p) : strlen(p);
+
+      writeFormat(writer, "%.*s", static_cast<int>(length), p);
+      p += length;
+
+      if (!*p)
+        break;
+
+      // flags, width and precision, then length modifiers which are ignored
+      const char* spec = p++;
+      while (*p && strchr("-+ #0123456789.", *p))
+        ++p;
+
+      size_t specLength = static_cast<size_t>(p - spec);
+
+      while (*p && strchr("hlLqjzt", *p))
+        ++p;
+
+      char conversion = *p ? *p++ : 0;
+
+      if (conversion == '%')
+        writeFormat(writer, "%%");
+      else if (conversion && strchr("diuoxXceEfFgGsp", conversion) && specLength < 16)
+      {
+        char specification[16];
+        memcpy(specification, spec, specLength);
+        specification[specLength] = 0;
+
+        writeBreadcrumbArgument(writer, specification, conversion, index < breadcrumb.argumentCount() ? &breadcrumb.argument(index) : PPK_ASSERT_NULLPTR);
+        ++index;
+      }
+      else // unsupported, written as is
+        writeFormat(writer, "%.*s", static_cast<int>(p - spec), spec);
+    }
+  }
+
+  // appends the calling thread's breadcrumbs to the message, outermost first:
+  // "message (while parsing foo > reading bar)", or "while parsing foo > reading
+  // bar" without a message
+  const char* appendBreadcrumbs(char* buffer, size_t size, const char* message)
+  {
+    const implementation::Breadcrumb* breadcrumbs[PPK_ASSERT_BREADCRUMB_DEPTH];
+    int count = 0;
+
+    for (const implementation::Breadcrumb* breadcrumb = implementation::breadcrumbs(); breadcrumb; breadcrumb = breadcrumb->previous())
+    {
+      if (count < PPK_ASSERT_BREADCRUMB_DEPTH)
+        breadcrumbs[count++] = breadcrumb;
+    }
+
+    if (!count)
+      return message;
+
+    TextWriter writer = {buffer, size, message ? strlen(buffer) : 0};
+
+    writeFormat(writer, message ? " (while " : "while ");
+
+    for (int i = count - 1; i >= 0; --i)
+    {
+      writeBreadcrumb(writer, *breadcrumbs[i]);
+
+      if (i)
+        writeFormat(writer, " > ");
+    }
+
+    if (message)
+      writeFormat(writer, ")");
+
+    buffer[writer.length < size ? writer.length : size - 1] = 0;
+
+    return buffer;
+  }
+
+  void writeLabel(TextWriter& writer, const char* value)
+  {
+    for (; *value; ++value)
+    {
+      if (*value == '\\' || *value == '"' || *value == '\n')
+        writeChar(writer, '\\');
+
+      writeChar(writer, *value == '\n' ? 'n' : *value);
+    }
+  }
+
+  void writeSeries(TextWriter& writer, const char* name, const char* file, int line, const char* level, long value)
+  {
+    writeFormat(writer, "%s{file=\"", name);
+    writeLabel(writer, file);
+    writeFormat(writer, "\",line=\"%d\",level=\"%s\"} %ld\n", line, level, value);
+  }
+
+  uint64_t hashString64(uint64_t hash, const char* s)
+  {
+    // FNV-1a
+    for (; s && *s; ++s)
+      hash = (hash ^ static_cast<unsigned char>(*s)) * UINT64_C(1099511628211);
+
+    return hash;
+  }
+
+  // unlike hashSite(), doesn't depend on the width of unsigned long so that
+  // it's stable across builds and platforms
+  uint64_t hashSite64(const char* file, int line, const char* expression)
+  {
+    uint64_t hash = hashString64(UINT64_C(14695981039346656037), file);
+    hash = (hash ^ static_cast<uint64_t>(line)) * UINT64_C(1099511628211);
+    hash = hashString64(hash, expression);
+
+    return hash ? hash : 1; // 0 marks an empty slot
+  }
+
+  // sites are keyed by file name, without the directory
+  const char* baseName(const char* file)
+  {
+    const char* file_;
+
+#if defined(_WIN32)
+    file_ = strrchr(file, '\\');
+#else
+    file_ = strrchr(file, '/');
+#endif // #if defined(_WIN32)
+
+    return file_ ? file_ + 1 : file;
+  }
+
+  void copyString(char* destination, size_t size, const char* source)
+  {
+    size_t length = 0;
+
+    if (source)
+    {
+      length = strlen(source);
+
+      if (length >= size)
+        length = size - 1;
+
+      memcpy(destination, source, length);
+    }
+
+    destination[length] = 0;
+  }
+
+#if !defined(_WIN32)
+  PPK_STATIC_ASSERT((PPK_ASSERT_STATS_CAPACITY & (PPK_ASSERT_STATS_CAPACITY - 1)) == 0, "PPK_ASSERT_STATS_CAPACITY must be a power of 2");
+
+  implementation::StatsHeader* volatile _statsFile = PPK_ASSERT_NULLPTR;
+  implementation::StatsHeader* volatile _statsSegment = PPK_ASSERT_NULLPTR;
+
+  implementation::StatsRecord* statsRecords(implementation::StatsHeader* header)
+  {
+    return reinterpret_cast<implementation::StatsRecord*>(header + 1);
+  }
+
+  // maps a table starting with an immutable prefix describing its layout,
+  // reinitializing it when the prefix doesn't match, mappings are never
+  // released because other threads may still be using them
+  void* mapTable(int fd, size_t size, const char* prefix, size_t prefixSize)
+  {
+    // serializes initialization with other processes
+    if (flock(fd, LOCK_EX) != 0)
+      return PPK_ASSERT_NULLPTR;
+
+    char* table = PPK_ASSERT_NULLPTR;
+    struct stat st;
+
+    if (fstat(fd, &st) == 0)
+    {
+      bool valid = false;
+
+      if (static_cast<size_t>(st.st_size) == size)
+      {
+        char existing[64];
+        valid = prefixSize <= sizeof(existing)
+             && pread(fd, existing, prefixSize, 0) == static_cast<ssize_t>(prefixSize)
+             && memcmp(existing, prefix, prefixSize) == 0;
+      }
+
+      if (valid || (ftruncate(fd, 0) == 0 && ftruncate(fd, static_cast<off_t>(size)) == 0))
+      {
+        void* p = mmap(PPK_ASSERT_NULLPTR, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (p != MAP_FAILED)
+        {
+          table = static_cast<char*>(p);
+
+          // the magic number comes first and is written last
+          if (!valid)
+          {
+            memcpy(table + 8, prefix + 8, prefixSize - 8);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            memcpy(table, prefix, 8);
+          }
+        }
+      }
+    }
+
+    flock(fd, LOCK_UN);
+
+    return table;
+  }
+
+  implementation::StatsHeader* mapStatsTable(int fd)
+  {
+    implementation::StatsHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PPK_ASSERT_STATS_MAGIC, sizeof(header.magic));
+    header.version = PPK_ASSERT_STATS_VERSION;
+    header.capacity = PPK_ASSERT_STATS_CAPACITY;
+
+    const size_t size = sizeof(implementation::StatsHeader) + PPK_ASSERT_STATS_CAPACITY * sizeof(implementation::StatsRecord);
+
+    return static_cast<implementation::StatsHeader*>(mapTable(fd, size, reinterpret_cast<const char*>(&header), offsetof(implementation::StatsHeader, overflow)));
+  }
+
+  // lock-free, records are claimed by atomically setting their hash
+  void recordStats(implementation::StatsHeader* header, const char* file, int line, const char* expression, int level)
+  {
+    uint64_t hash = hashSite64(file, line, expression);
+    implementation::StatsRecord* records = statsRecords(header);
+
+    for (uint32_t i = 0; i < header->capacity; ++i)
+    {
+      implementation::StatsRecord& record = records[(hash + i) & (header->capacity - 1)];
+      uint64_t expected = 0;
+
+      if (__atomic_compare_exchange_n(&record.hash, &expected, hash, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      {
+        record.line = line;
+        record.level = level;
+        copyString(record.file, sizeof(record.file), file);
+        copyString(record.expression, sizeof(record.expression), expression);
+      }
+      else if (expected != hash)
+      {
+        continue;
+      }
+
+      __atomic_add_fetch(&record.failures, 1, __ATOMIC_RELAXED);
+      __atomic_store_n(&record.lastSeen, static_cast<int64_t>(time(PPK_ASSERT_NULLPTR)), __ATOMIC_RELAXED);
+      return;
+    }
+
+    __atomic_add_fetch(&header->overflow, 1, __ATOMIC_RELAXED);
+  }
+#endif
+
+  // cached, saves a system call per failed assertion, forgotten by the child
+  // after fork()
+  PPK_ASSERT_THREAD_LOCAL uint64_t _threadId = 0;
+  volatile long _processId = 0;
+
+  uint64_t currentThreadId()
+  {
+#if defined(_WIN32)
+    return ::GetCurrentThreadId();
+#else
+    if (!_threadId)
+    {
+#if defined(__linux__)
+      _threadId = static_cast<uint64_t>(syscall(SYS_gettid));
+#elif defined(__APPLE__)
+      pthread_threadid_np(PPK_ASSERT_NULLPTR, &_threadId);
+#else
+      _threadId = reinterpret_cast<uint64_t>(pthread_self());
+#endif
+    }
+
+    return _threadId;
+#endif
+  }
+
+  int32_t currentProcessId()
+  {
+#if defined(_WIN32)
+    return static_cast<int32_t>(::GetCurrentProcessId());
+#else
+    long pid = atomicLoad(&_processId);
+
+    if (!pid)
+    {
+      pid = static_cast<long>(getpid());
+      atomicStore(&_processId, pid);
+    }
+
+    return static_cast<int32_t>(pid);
+#endif
+  }
+
+  PPK_STATIC_ASSERT((PPK_ASSERT_STACK_TABLE_SIZE & (PPK_ASSERT_STACK_TABLE_SIZE - 1)) == 0, "PPK_ASSERT_STACK_TABLE_SIZE must be a power of 2");
+  PPK_STATIC_ASSERT((PPK_ASSERT_SYMBOL_CACHE_SIZE & (PPK_ASSERT_SYMBOL_CACHE_SIZE - 1)) == 0, "PPK_ASSERT_SYMBOL_CACHE_SIZE must be a power of 2");
+
+  // counts failures per distinct stack, slots are claimed by setting their
+  // hash
+  struct StackEntry
+  {
+    volatile long hash;
+    volatile long occurrences;
+  };
+
+  StackEntry _stacks[PPK_ASSERT_STACK_TABLE_SIZE];
+
+  PPK_ASSERT_THREAD_LOCAL const implementation::StackTrace* _currentStack = PPK_ASSERT_NULLPTR;
+  PPK_ASSERT_THREAD_LOCAL const implementation::EventRecord* _currentEvent = PPK_ASSERT_NULLPTR;
+  PPK_ASSERT_THREAD_LOCAL uint64_t _taskId = 0; // see AssertContext
+
+  // assertions failing while their thread is already handling one, e.g. fired
+  // by the assertion handler, aren't handled again
+  PPK_ASSERT_THREAD_LOCAL int _assertDepth = 0;
+  volatile long _nestedFailures = 0;
+
+  struct ReentrancyGuard
+  {
+    ReentrancyGuard() { ++_assertDepth; }
+    ~ReentrancyGuard() { --_assertDepth; }
+  };
+
+  // returns 0 when the table is full
+  unsigned long countStack(unsigned long hash)
+  {
+    for (unsigned long i = 0; i < PPK_ASSERT_STACK_TABLE_SIZE; ++i)
+    {
+      StackEntry& entry = _stacks[(hash + i) & (PPK_ASSERT_STACK_TABLE_SIZE - 1)];
+
+      if (!atomicLoad(&entry.hash))
+        atomicCompareExchange(&entry.hash, 0, static_cast<long>(hash));
+
+      if (static_cast<unsigned long>(atomicLoad(&entry.hash)) == hash)
+        return static_cast<unsigned long>(atomicAdd(&entry.occurrences, 1));
+    }
+
+    return 0;
+  }
+
+  // only unwinds, symbolization is deferred to symbolize()
+  PPK_ASSERT_NOINLINE void captureStack(implementation::StackTrace& stack)
+  {
+    const int skip = 2; // captureStack() and handleAssert()
+    int depth = 0;
+
+#if defined(PPK_ASSERT_HAVE_BACKTRACE)
+    void* frames[PPK_ASSERT_STACK_DEPTH + skip];
+    depth = backtrace(frames, PPK_ASSERT_STACK_DEPTH + skip) - skip;
+
+    if (depth > 0)
+      memcpy(stack.frames, frames + skip, depth * sizeof(void*));
+#elif defined(_WIN32)
+    depth = ::CaptureStackBackTrace(skip, PPK_ASSERT_STACK_DEPTH, stack.frames, PPK_ASSERT_NULLPTR);
+#endif
+
+    stack.depth = depth > 0 ? depth : 0;
+
+    unsigned long hash = 2166136261ul;
+
+    for (int i = 0; i < stack.depth; ++i)
+    {
+      const unsigned char* p = reinterpret_cast<const unsigned char*>(&stack.frames[i]);
+
+      for (size_t j = 0; j < sizeof(void*); ++j)
+        hash = ((hash ^ p[j]) * 16777619ul) & 0xfffffffful;
+    }
+
+    stack.hash = hash ? hash : 1;
+    stack.occurrences = stack.depth ? countStack(stack.hash) : 0;
+  }
+
+  struct SymbolEntry
+  {
+    const void* pc;
+    const char* symbol;
+  };
+
+  SymbolEntry _symbols[PPK_ASSERT_SYMBOL_CACHE_SIZE];
+  char _symbolArena[PPK_ASSERT_SYMBOL_ARENA_SIZE];
+  size_t _symbolArenaLength = 0;
+  volatile long _symbolsLock = 0;
+
+  void describeAddress(const void* pc, char* buffer, size_t size)
+  {
+#if defined(PPK_ASSERT_HAVE_BACKTRACE)
+    Dl_info info;
+
+    if (dladdr(pc, &info) && info.dli_fname)
+    {
+      const char* module = strrchr(info.dli_fname, '/');
+      module = module ? module + 1 : info.dli_fname;
+
+      if (info.dli_sname)
+      {
+        int status = -1;
+        char* demangled = abi::__cxa_demangle(info.dli_sname, PPK_ASSERT_NULLPTR, PPK_ASSERT_NULLPTR, &status);
+
+        snprintf(buffer, size, "%s+0x%lx (%s)", status == 0 ? demangled : info.dli_sname,
+                 static_cast<unsigned long>(static_cast<const char*>(pc) - static_cast<const char*>(info.dli_saddr)), module);
+        free(demangled);
+      }
+      else
+      {
+        // enough for addr2line
+        snprintf(buffer, size, "%s+0x%lx", module, static_cast<unsigned long>(static_cast<const char*>(pc) - static_cast<const char*>(info.dli_fbase)));
+      }
+
+      return;
+    }
+#endif
+
+    snprintf(buffer, size, "%p", pc);
+  }
+
+  // microseconds since epoch
+  int64_t wallClockTime()
+  {
+#if defined(_WIN32)
+    FILETIME ft;
+    ::GetSystemTimeAsFileTime(&ft);
+    uint64_t t = (static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+    return static_cast<int64_t>(t / 10) - INT64_C(11644473600000000); // 1601 to 1970
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+  }
+
+  // microseconds, only meaningful for measuring durations
+  int64_t monotonicTime()
+  {
+#if defined(_WIN32)
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    ::QueryPerformanceFrequency(&frequency);
+    ::QueryPerformanceCounter(&counter);
+    return counter.QuadPart / frequency.QuadPart * 1000000 + counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+  }
+
+#if defined(PPK_ASSERT_HAVE_TSC)
+  // the time stamp counter is only used when it's invariant, i.e. when it
+  // ticks at a constant rate regardless of frequency changes and sleep states
+  bool invariantTsc()
+  {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0x80000000);
+
+    if (static_cast<unsigned>(info[0]) < 0x80000007)
+      return false;
+
+    __cpuid(info, 0x80000007);
+    return (info[3] & (1 << 8)) != 0;
+#else
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8)) != 0;
+#endif
+  }
+
+  // the counter's frequency is measured once against the monotonic clock,
+  // from when the library got loaded to the first failed assertion at least
+  // 100 ms later
+  struct TscCalibration
+  {
+    TscCalibration()
+    : ticks(static_cast<int64_t>(__rdtsc()))
+    , time(monotonicTime())
+    {}
+
+    int64_t ticks;
+    int64_t time;
+  };
+
+  TscCalibration _tscCalibration;
+  volatile int64_t _tscFrequency = 0; // ticks per second, -1 when unusable
+
+  int64_t tscFrequency()
+  {
+    int64_t frequency = atomicLoad64(&_tscFrequency);
+
+    if (frequency)
+      return frequency;
+
+    int64_t ticks = static_cast<int64_t>(__rdtsc());
+    int64_t elapsed = monotonicTime() - _tscCalibration.time;
+
+    if (elapsed < 100000)
+      return 0;
+
+    frequency = invariantTsc() && ticks > _tscCalibration.ticks ? static_cast<int64_t>(static_cast<double>(ticks - _tscCalibration.ticks) * 1000000 / static_cast<double>(elapsed)) : -1;
+    atomicStore64(&_tscFrequency, frequency);
+
+    return frequency;
+  }
+
+  // each thread reads the wall clock at most once per second and interpolates
+  // with the counter in between, which keeps the drift from the wall clock,
+  // e.g. while NTP slews it, negligible
+  PPK_ASSERT_THREAD_LOCAL int64_t _tscAnchorTicks = 0;
+  PPK_ASSERT_THREAD_LOCAL int64_t _tscAnchorTime = 0;
+#endif
+
+  // microseconds since epoch, cheap when the time stamp counter is usable
+  int64_t currentTime()
+  {
+#if defined(PPK_ASSERT_HAVE_TSC)
+    int64_t frequency = tscFrequency();
+
+    if (frequency > 0)
+    {
+      int64_t ticks = static_cast<int64_t>(__rdtsc());
+      int64_t elapsed = ticks - _tscAnchorTicks;
+
+      if (_tscAnchorTicks && elapsed >= 0 && elapsed < frequency)
+        return _tscAnchorTime + elapsed * 1000000 / frequency;
+
+      _tscAnchorTicks = ticks;
+      _tscAnchorTime = wallClockTime();
+
+      return _tscAnchorTime;
+    }
+#endif
+
+    return wallClockTime();
+  }
+
+  // time spent in the assertion handler, including waiting for the user
+  volatile long _handlerCalls = 0;
+  volatile int64_t _handlerTime = 0;
+  volatile int64_t _handlerMaxTime = 0;
+
+  void recordHandlerTime(int64_t elapsed)
+  {
+    atomicAdd(&_handlerCalls, 1);
+    atomicAdd64(&_handlerTime, elapsed);
+    atomicMax64(&_handlerMaxTime, elapsed);
+  }
+
+  // latency async dispatch adds to failing threads, see DispatchLatency
+  volatile long _dispatchBuckets[PPK_ASSERT_DISPATCH_LATENCY_BUCKETS];
+  volatile int64_t _dispatchTime = 0;
+  volatile int64_t _dispatchMaxTime = 0;
+
+  void recordDispatchLatency(int64_t elapsed)
+  {
+    int bucket = 0;
+
+    while (bucket < PPK_ASSERT_DISPATCH_LATENCY_BUCKETS - 1 && elapsed >= (INT64_C(1) << bucket))
+      ++bucket;
+
+    atomicAdd(&_dispatchBuckets[bucket], 1);
+    atomicAdd64(&_dispatchTime, elapsed);
+    atomicMax64(&_dispatchMaxTime, elapsed);
+  }
+
+  // what failing threads do with async dispatch, see setDispatchPolicy(). A
+  // level never changes once published by the count, its action may
+  volatile long _dispatchPolicyLock = 0;
+  volatile long _dispatchPolicyCount = 1;
+  long _dispatchPolicyLevels[PPK_ASSERT_DISPATCH_POLICIES] = {AssertLevel::Error};
+  volatile long _dispatchPolicyActions[PPK_ASSERT_DISPATCH_POLICIES] = {AssertAction::Throw};
+
+  // the action of the highest level with a policy not above level
+  AssertAction::AssertAction dispatchPolicy(int level)
+  {
+    long count = atomicLoad(&_dispatchPolicyCount);
+    const long* best = PPK_ASSERT_NULLPTR;
+    AssertAction::AssertAction action = AssertAction::None;
+
+    for (long i = 0; i < count; ++i)
+    {
+      if (_dispatchPolicyLevels[i] <= level && (!best || _dispatchPolicyLevels[i] > *best))
+      {
+        best = &_dispatchPolicyLevels[i];
+        action = static_cast<AssertAction::AssertAction>(atomicLoad(&_dispatchPolicyActions[i]));
+      }
+    }
+
+    return action;
+  }
+
+  // latency of each stage of handleAssert(), see StageLatency
+#define PPK_ASSERT_LATENCY_LEVELS 4
+  const int _latencyLevels[PPK_ASSERT_LATENCY_LEVELS] = {AssertLevel::Warning, AssertLevel::Debug, AssertLevel::Error, AssertLevel::Fatal};
+
+  volatile long _stageBuckets[PPK_ASSERT_LATENCY_LEVELS][AssertStage::Count][PPK_ASSERT_LATENCY_BUCKETS];
+  volatile int64_t _stageTime[PPK_ASSERT_LATENCY_LEVELS][AssertStage::Count];
+  volatile int64_t _stageMaxTime[PPK_ASSERT_LATENCY_LEVELS][AssertStage::Count];
+
+  const char* const _stageNames[AssertStage::Count] = {"lookup", "format", "record", "publish", "stack", "subscribers", "handler", "dispatch", "throw", "total"};
+
+  int latencyLevel(int level)
+  {
+    int i = PPK_ASSERT_LATENCY_LEVELS - 1;
+
+    while (i > 0 && level < _latencyLevels[i])
+      --i;
+
+    return i;
+  }
+
+  int latencyBucket(int64_t value)
+  {
+    if (value < 4)
+      return value < 0 ? 0 : static_cast<int>(value);
+
+    int exponent = 2;
+
+    while (exponent < 62 && (value >> (exponent + 1)))
+      ++exponent;
+
+    int bucket = (exponent - 1) * 4 + static_cast<int>((value >> (exponent - 2)) & 3);
+
+    return bucket < PPK_ASSERT_LATENCY_BUCKETS ? bucket : PPK_ASSERT_LATENCY_BUCKETS - 1;
+  }
+
+  // times the stages of handling a failed assertion: each lap() closes the
+  // current stage, the last one is closed when the timer goes out of scope,
+  // possibly while unwinding, along with the total
+  class StageTimer
+  {
+  public:
+    explicit StageTimer(int level)
+    : _level(latencyLevel(level))
+    , _frequency(0)
+    , _stage(-1)
+    , _discarded(false)
+    {
+#if defined(PPK_ASSERT_HAVE_TSC)
+      _frequency = tscFrequency();
+#endif
+      _start = _last = now();
+    }
+
+    ~StageTimer()
+    {
+      if (_discarded)
+        return;
+
+      int64_t end = now();
+
+      if (_stage >= 0)
+        record(_stage, end - _last);
+
+      record(AssertStage::Total, end - _start);
+    }
+
+    void lap(int stage)
+    {
+      int64_t end = now();
+      record(stage, end - _last);
+      _last = end;
+    }
+
+    // the stage closed by the destructor
+    void open(int stage)
+    {
+      _last = now();
+      _stage = stage;
+    }
+
+    void discard()
+    {
+      _discarded = true;
+    }
+
+    // nanoseconds since the timer was started
+    int64_t elapsed() const
+    {
+      return nanoseconds(now() - _start);
+    }
+
+  private:
+    StageTimer(const StageTimer&);
+    StageTimer& operator=(const StageTimer&);
+
+    // ticks when the time stamp counter is usable, microseconds otherwise
+    int64_t now() const
+    {
+#if defined(PPK_ASSERT_HAVE_TSC)
+      if (_frequency > 0)
+        return static_cast<int64_t>(__rdtsc());
+#endif
+      return monotonicTime();
+    }
+
+    int64_t nanoseconds(int64_t elapsed) const
+    {
+      return _frequency > 0 ? static_cast<int64_t>(static_cast<double>(elapsed) * 1e9 / static_cast<double>(_frequency)) : elapsed * 1000;
+    }
+
+    void record(int stage, int64_t elapsed)
+    {
+      int64_t value = nanoseconds(elapsed);
+
+      atomicAdd(&_stageBuckets[_level][stage][latencyBucket(value)], 1);
+      atomicAdd64(&_stageTime[_level][stage], value);
+      atomicMax64(&_stageMaxTime[_level][stage], value);
+    }
+
+    int _level;
+    int64_t _frequency;
+    int64_t _start;
+    int64_t _last;
+    int _stage;
+    bool _discarded;
+  };
+
+#if defined(PPK_ASSERT_SERVER_MODE)
+  volatile long _serverMode = 1;
+#else
+  volatile long _serverMode = 0;
+#endif
+
+  // the default handler only prompts the user when somebody can answer
+  bool isInteractive()
+  {
+    if (atomicLoad(&_serverMode))
+      return false;
+
+#if defined(_WIN32)
+    return _isatty(_fileno(stdin)) && _isatty(_fileno(stderr));
+#else
+    if (!isatty(STDIN_FILENO) || !isatty(STDERR_FILENO))
+      return false;
+
+    // daemons don't have a controlling terminal
+    int fd = open("/dev/tty", O_RDONLY | O_NOCTTY | O_CLOEXEC);
+
+    if (fd < 0)
+      return false;
+
+    close(fd);
+    return true;
+#endif
+  }
+
+  void fillEventRecord(implementation::EventRecord& event, const char* file, int line, const char* function, const char* expression, int level, const char* message)
+  {
+    event.sequence = 0;
+    event.time = currentTime();
+    event.threadId = currentThreadId();
+    event.processId = currentProcessId();
+    event.line = line;
+    event.level = level;
+    event.reserved = 0;
+
+    for (int i = 0; i < PPK_ASSERT_CORRELATION_WORDS; ++i)
+      event.correlation[i] = implementation::correlation(i);
+
+    event.taskId = _taskId;
+
+    copyString(event.file, sizeof(event.file), file);
+    copyString(event.function, sizeof(event.function), function);
+    copyString(event.expression, sizeof(event.expression), expression);
+    copyString(event.message, sizeof(event.message), message);
+  }
+
+  PPK_STATIC_ASSERT((PPK_ASSERT_FLIGHT_RECORDER_SIZE & (PPK_ASSERT_FLIGHT_RECORDER_SIZE - 1)) == 0, "PPK_ASSERT_FLIGHT_RECORDER_SIZE must be a power of 2");
+
+  // same protocol as the event rings except that several threads write to it:
+  // a record is torn only if the flight recorder wraps around while it's
+  // being written
+  struct FlightRecord
+  {
+    volatile long sequence;
+    implementation::EventRecord event;
+  };
+
+  FlightRecord _flightRecorder[PPK_ASSERT_FLIGHT_RECORDER_SIZE];
+  volatile long _flightRecorderHead = 0;
+
+  void recordFlight(const implementation::EventRecord& event)
+  {
+    long position = atomicAdd(&_flightRecorderHead, 1) - 1;
+    FlightRecord& record = _flightRecorder[position & (PPK_ASSERT_FLIGHT_RECORDER_SIZE - 1)];
+
+    atomicStore(&record.sequence, 0);
+    record.event = event;
+    atomicStore(&record.sequence, position + 1);
+  }
+
+  struct Subscriber
+  {
+    implementation::AssertSubscriber callback; // null terminates a list
+    void* context;
+  };
+
+  // lists are never modified once published: writers replace them and free
+  // the previous one after a grace period, i.e. once the readers that may
+  // still see it are gone. Readers register in one of two counters, the
+  // phase tells which
+  Subscriber* volatile _subscribers = PPK_ASSERT_NULLPTR;
+  volatile long _subscribersPhase = 0;
+  volatile long _subscribersReaders[2] = {0, 0};
+  volatile long _subscribersLock = 0; // writers only
+
+  // leaves the read side even when a subscriber throws
+  struct SubscribersReader
+  {
+    explicit SubscribersReader(volatile long* readers)
+    : readers(readers)
+    {
+      atomicAdd(readers, 1);
+    }
+
+    ~SubscribersReader()
+    {
+      atomicAdd(readers, -1);
+    }
+
+    volatile long* readers;
+  };
+
+  void notifySubscribers(const implementation::EventRecord& event)
+  {
+    SubscribersReader reader(&_subscribersReaders[atomicLoad(&_subscribersPhase) & 1]);
+
+    if (const Subscriber* subscribers = atomicLoadPointer(&_subscribers))
+    {
+      for (const Subscriber* s = subscribers; s->callback; ++s)
+        s->callback(event, s->context);
+    }
+  }
+
+  // flipping the phase twice is what catches readers that picked a counter
+  // before the first flip but registered after its wait
+  void waitForReaders()
+  {
+    for (int i = 0; i < 2; ++i)
+    {
+      long phase = atomicAdd(&_subscribersPhase, 1) - 1;
+
+      while (atomicLoad(&_subscribersReaders[phase & 1]) != 0)
+        yieldThread();
+    }
+  }
+
+  // replaces the subscribers with a copy that has subscriber added or
+  // removed, returns false when there's nothing to remove or no memory
+  bool updateSubscribers(implementation::AssertSubscriber callback, void* context, bool add)
+  {
+    SpinLock lock(&_subscribersLock);
+
+    Subscriber* current = atomicLoadPointer(&_subscribers);
+    size_t count = 0;
+    bool found = false;
+
+    for (const Subscriber* s = current; s && s->callback; ++s, ++count)
+    {
+      if (s->callback == callback && s->context == context)
+        found = true;
+    }
+
+    if (!add && !found)
+      return false;
+
+    size_t capacity = add ? count + 2 : count; // including the terminator
+    Subscriber* next = PPK_ASSERT_NULLPTR;
+
+    if (capacity > 1)
+    {
+      next = static_cast<Subscriber*>(PPK_ASSERT_MALLOC(sizeof(Subscriber) * capacity));
+
+      if (!next)
+        return false;
+
+      size_t length = 0;
+      bool removed = false;
+
+      for (size_t i = 0; i < count; ++i)
+      {
+        if (!add && !removed && current[i].callback == callback && current[i].context == context)
+        {
+          removed = true; // only one of them
+          continue;
+        }
+
+        next[length++] = current[i];
+      }
+
+      if (add)
+      {
+        next[length].callback = callback;
+        next[length++].context = context;
+      }
+
+      next[length].callback = PPK_ASSERT_NULLPTR;
+      next[length].context = PPK_ASSERT_NULLPTR;
+    }
+
+    atomicStorePointer(&_subscribers, next);
+    waitForReaders();
+
+    if (current)
+      PPK_ASSERT_FREE(current);
+
+    return true;
+  }
+
+#if defined(PPK_ASSERT_HAVE_SHM)
+  PPK_STATIC_ASSERT((PPK_ASSERT_EVENT_RING_SIZE & (PPK_ASSERT_EVENT_RING_SIZE - 1)) == 0, "PPK_ASSERT_EVENT_RING_SIZE must be a power of 2");
+
+  implementation::EventsHeader* volatile _eventSegment = PPK_ASSERT_NULLPTR;
+
+  // the ring claimed by the current thread, and the segment it belongs to
+  PPK_ASSERT_THREAD_LOCAL implementation::EventRing* _eventRing = PPK_ASSERT_NULLPTR;
+  PPK_ASSERT_THREAD_LOCAL implementation::EventsHeader* _eventRingSegment = PPK_ASSERT_NULLPTR;
+
+  pthread_once_t _eventRingOnce = PTHREAD_ONCE_INIT;
+  pthread_key_t _eventRingKey;
+  volatile long _eventRingTokens = 0;
+
+  void releaseEventRing(void* ring)
+  {
+    __atomic_store_n(&static_cast<implementation::EventRing*>(ring)->owner, 0, __ATOMIC_RELEASE);
+  }
+
+  // after fork(), the surviving thread must not keep writing to its parent's
+  // ring
+  void forgetEventRing()
+  {
+    _eventRing = PPK_ASSERT_NULLPTR;
+    _eventRingSegment = PPK_ASSERT_NULLPTR;
+  }
+
+  void initializeEventRings()
+  {
+    pthread_key_create(&_eventRingKey, releaseEventRing);
+    pthread_atfork(PPK_ASSERT_NULLPTR, PPK_ASSERT_NULLPTR, forgetEventRing);
+  }
+
+  // claims an available ring, or one owned by a process that died
+  implementation::EventRing* claimEventRing(implementation::EventsHeader* header)
+  {
+    pthread_once(&_eventRingOnce, initializeEventRings);
+
+    implementation::EventRing* rings = reinterpret_cast<implementation::EventRing*>(header + 1);
+    uint64_t pid = static_cast<uint64_t>(getpid());
+    uint64_t owner = (pid << 32) | static_cast<uint32_t>(atomicAdd(&_eventRingTokens, 1));
+
+    for (int steal = 0; steal < 2; ++steal)
+    {
+      for (uint32_t i = 0; i < header->rings; ++i)
+      {
+        uint64_t expected = __atomic_load_n(&rings[i].owner, __ATOMIC_ACQUIRE);
+        pid_t ownerPid = static_cast<pid_t>(expected >> 32);
+
+        if (expected && !(steal && ownerPid != static_cast<pid_t>(pid) && kill(ownerPid, 0) != 0 && errno == ESRCH))
+          continue;
+
+        if (__atomic_compare_exchange_n(&rings[i].owner, &expected, owner, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+          pthread_setspecific(_eventRingKey, &rings[i]);
+          return &rings[i];
+        }
+      }
+    }
+
+    return PPK_ASSERT_NULLPTR;
+  }
+
+  // seqlock protocol: readers check the sequence of a record before and after
+  // reading it
+  void publishEvent(implementation::EventsHeader* header, const implementation::EventRecord& event)
+  {
+    if (_eventRingSegment != header)
+    {
+      _eventRing = claimEventRing(header);
+
+      if (!_eventRing)
+        return; // every ring is in use, the event is dropped
+
+      _eventRingSegment = header;
+    }
+
+    implementation::EventRing* ring = _eventRing;
+
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    implementation::EventRecord& record = ring->records[head & (PPK_ASSERT_EVENT_RING_SIZE - 1)];
+
+    __atomic_store_n(&record.sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(reinterpret_cast<char*>(&record) + sizeof(record.sequence), reinterpret_cast<const char*>(&event) + sizeof(event.sequence), sizeof(event) - sizeof(event.sequence));
+    __atomic_store_n(&record.sequence, head + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+  }
+#endif
+
+#if !defined(_WIN32)
+  // a background thread woken up through a pipe when it has to stop
+  struct Service
+  {
+    pthread_t thread;
+    int wakeup[2];
+    bool running;
+  };
+
+  bool startService(Service& service, void* (*run)(void*))
+  {
+    if (service.running || pipe(service.wakeup) != 0)
+      return false;
+
+    if (pthread_create(&service.thread, PPK_ASSERT_NULLPTR, run, &service) != 0)
+    {
+      close(service.wakeup[0]);
+      close(service.wakeup[1]);
+      return false;
+    }
+
+    service.running = true;
+    return true;
+  }
+
+  void stopService(Service& service)
+  {
+    if (!service.running)
+      return;
+
+    if (write(service.wakeup[1], "", 1) == 1)
+      pthread_join(service.thread, PPK_ASSERT_NULLPTR);
+
+    close(service.wakeup[0]);
+    close(service.wakeup[1]);
+    service.running = false;
+  }
+
+  // waits for fd to be readable, fd may be -1 to merely sleep for timeout
+  // milliseconds, returns false when the service must stop
+  bool waitService(Service& service, int fd, int timeout, bool* readable)
+  {
+    struct pollfd fds[2] = {{service.wakeup[0], POLLIN, 0}, {fd, POLLIN, 0}};
+
+    for (;;)
+    {
+      int n = poll(fds, 2, timeout);
+
+      if (n < 0 && errno == EINTR)
+        continue;
+
+      if (n < 0 || fds[0].revents)
+        return false;
+
+      *readable = fds[1].revents != 0;
+      return true;
+    }
+  }
+
+  int _adminSocket = -1;
+  Service _adminService;
+
+  bool sendAll(int fd, const char* buffer, size_t length)
+  {
+#if defined(MSG_NOSIGNAL)
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0; // SO_NOSIGPIPE is set on the socket instead
+#endif
+
+    while (length)
+    {
+      ssize_t n = send(fd, buffer, length, flags);
+
+      if (n < 0 && errno == EINTR)
+        continue;
+
+      if (n <= 0)
+        return false;
+
+      buffer += n;
+      length -= static_cast<size_t>(n);
+    }
+
+    return true;
+  }
+
+  void reply(int fd, const char* format, ...)
+  {
+    char buffer[512];
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    if (length > 0)
+      sendAll(fd, buffer, static_cast<size_t>(length) < sizeof(buffer) ? static_cast<size_t>(length) : sizeof(buffer) - 1);
+  }
+
+  bool parseLevel(const char* s, long* level)
+  {
+    static const int levels[] = {AssertLevel::Warning, AssertLevel::Debug, AssertLevel::Error, AssertLevel::Fatal};
+
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); ++i)
+    {
+      if (strcasecmp(s, levelString(levels[i])) == 0)
+      {
+        *level = levels[i];
+        return true;
+      }
+    }
+
+    char* end;
+    *level = strtol(s, &end, 0);
+
+    return *s && !*end;
+  }
+
+  void muteSite(Site& site, bool mute)
+  {
+    if ((atomicLoad(&site.muted) != 0) == mute)
+      return;
+
+    atomicStore(&site.muted, mute);
+
+    // the flag tested by PPK_ASSERT_3 before calling handleAssert(), unmuting
+    // only clears it when muting set it, not after an IgnoreLine answer
+    if (mute && site.ignoreLine && !implementation::lineIgnored(site.ignoreLine))
+    {
+      site.mutedLine = true;
+      storeLineIgnored(site.ignoreLine, true);
+    }
+    else if (!mute && site.mutedLine)
+    {
+      site.mutedLine = false;
+      storeLineIgnored(site.ignoreLine, false);
+    }
+  }
+
+  void runAdminCommand(int fd, const char* command)
+  {
+    char verb[32] = {0};
+    char argument[64] = {0};
+
+    if (sscanf(command, " %31s %63s", verb, argument) < 1)
+      return;
+
+    if (strcmp(verb, "list") == 0)
+    {
+      for (unsigned long i = 0; i < PPK_ASSERT_SITE_TABLE_SIZE; ++i)
+      {
+        Site& site = _sites[i];
+
+        if (!atomicLoad(&site.ready))
+          continue;
+
+        const char* level = levelString(site.level);
+        char custom[16];
+
+        if (!level)
+        {
+          snprintf(custom, sizeof(custom), "%d", site.level);
+          level = custom;
+        }
+
+        reply(fd, "%08lx %s %ld%s %s:%d '%s'\n", site.hash, level, atomicLoad(&site.failures), atomicLoad(&site.muted) ? " muted" : "", site.file, site.line, site.expression);
+      }
+    }
+    else if (strcmp(verb, "stats") == 0)
+    {
+      long sites = 0;
+      long failures = 0;
+      long muted = 0;
+
+      for (unsigned long i = 0; i < PPK_ASSERT_SITE_TABLE_SIZE; ++i)
+      {
+        Site& site = _sites[i];
+
+        if (!atomicLoad(&site.ready))
+          continue;
+
+        ++sites;
+        failures += atomicLoad(&site.failures);
+        muted += atomicLoad(&site.muted) ? 1 : 0;
+      }
+
+      reply(fd, "sites %ld\nfailures %ld\nmuted %ld\nlevel %ld\nignore-all %s\nserver-mode %s\n", sites, failures, muted, atomicLoad(&_levelThreshold), ppk::assert::implementation::ignoreAllAsserts() ? "on" : "off", atomicLoad(&_serverMode) ? "on" : "off");
+      reply(fd, "handler-calls %ld\nhandler-time-us %.0f\nhandler-max-us %.0f\n", atomicLoad(&_handlerCalls), static_cast<double>(atomicLoad64(&_handlerTime)), static_cast<double>(atomicLoad64(&_handlerMaxTime)));
+
+      implementation::DispatchLatency latency = ppk::assert::implementation::dispatchLatency();
+      reply(fd, "dispatched %lu\ndispatch-dropped %lu\ndispatch-max-us %.0f\n", latency.count, ppk::assert::implementation::droppedDispatchedEvents(), static_cast<double>(latency.max));
+    }
+    else if (strcmp(verb, "mute") == 0 || strcmp(verb, "unmute") == 0)
+    {
+      char* end;
+      unsigned long hash = strtoul(argument, &end, 16);
+      Site* site = PPK_ASSERT_NULLPTR;
+
+      for (unsigned long i = 0; *argument && !*end && i < PPK_ASSERT_SITE_TABLE_SIZE && !site; ++i)
+      {
+        if (atomicLoad(&_sites[i].ready) && _sites[i].hash == hash)
+          site = &_sites[i];
+      }
+
+      if (!site)
+      {
+        reply(fd, "error: unknown site '%s'\n", argument);
+        return;
+      }
+
+      muteSite(*site, verb[0] == 'm');
+    }
+    else if (strcmp(verb, "level") == 0)
+    {
+      long level;
+
+      if (!parseLevel(argument, &level))
+      {
+        reply(fd, "error: invalid level '%s'\n", argument);
+        return;
+      }
+
+      atomicStore(&_levelThreshold, level);
+    }
+    else if (strcmp(verb, "ignore-all") == 0)
+    {
+      if (strcmp(argument, "on") != 0 && strcmp(argument, "off") != 0)
+      {
+        reply(fd, "error: expected 'on' or 'off'\n");
+        return;
+      }
+
+      ppk::assert::implementation::ignoreAllAsserts(strcmp(argument, "on") == 0);
+    }
+    else if (strcmp(verb, "server-mode") == 0)
+    {
+      if (strcmp(argument, "on") != 0 && strcmp(argument, "off") != 0)
+      {
+        reply(fd, "error: expected 'on' or 'off'\n");
+        return;
+      }
+
+      ppk::assert::implementation::serverMode(strcmp(argument, "on") == 0);
+    }
+    else if (strcmp(verb, "latency") == 0)
+    {
+      ppk::assert::implementation::dumpStageLatency(fd);
+    }
+    else if (strcmp(verb, "help") == 0)
+    {
+      reply(fd, "list\nstats\nlatency\nmute <site>\nunmute <site>\nlevel <level>\nignore-all on|off\nserver-mode on|off\n");
+    }
+    else
+    {
+      reply(fd, "error: unknown command '%s'\n", verb);
+      return;
+    }
+
+    reply(fd, "ok\n");
+  }
+
+  void serveAdminClient(int fd)
+  {
+    char buffer[256];
+    size_t length = 0;
+
+    for (;;)
+    {
+      ssize_t n = recv(fd, buffer + length, sizeof(buffer) - 1 - length, 0);
+
+      if (n < 0 && errno == EINTR)
+        continue;
+
+      if (n <= 0)
+        return;
+
+      length += static_cast<size_t>(n);
+      buffer[length] = 0;
+
+      char* begin = buffer;
+      while (char* end = strchr(begin, '\n'))
+      {
+        *end = 0;
+        runAdminCommand(fd, begin);
+        begin = end + 1;
+      }
+
+      length -= static_cast<size_t>(begin - buffer);
+      memmove(buffer, begin, length);
+
+      if (length == sizeof(buffer) - 1)
+      {
+        reply(fd, "error: command too long\n");
+        return;
+      }
+    }
+  }
+
+  void closeAdminSocket()
+  {
+    struct sockaddr_un address;
+    socklen_t length = sizeof(address);
+
+    if (getsockname(_adminSocket, reinterpret_cast<struct sockaddr*>(&address), &length) == 0)
+      unlink(address.sun_path);
+
+    close(_adminSocket);
+    _adminSocket = -1;
+  }
+
+  void* serveAdmin(void*)
+  {
+    bool readable;
+
+    while (waitService(_adminService, _adminSocket, -1, &readable))
+    {
+      int client = accept(_adminSocket, PPK_ASSERT_NULLPTR, PPK_ASSERT_NULLPTR);
+
+      if (client < 0)
+        continue;
+
+      // clients are served one at a time, don't let one of them hang the server
+      struct timeval timeout = {10, 0};
+      setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#if defined(SO_NOSIGPIPE)
+      int one = 1;
+      setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+      serveAdminClient(client);
+      close(client);
+    }
+
+    return PPK_ASSERT_NULLPTR;
+  }
+
+  Service _metricsService;
+  int _metricsSocket = -1;
+  char _metricsPath[1024];
+  int _metricsInterval;
+  int _metricsMaxSites;
+  char _metricsBuffer[PPK_ASSERT_METRICS_BUFFER_SIZE]; // only used by the exporter thread
+
+  size_t renderMetrics()
+  {
+    size_t length = implementation::writeMetrics(_metricsBuffer, sizeof(_metricsBuffer), _metricsMaxSites);
+
+    if (length >= sizeof(_metricsBuffer))
+    {
+      for (length = sizeof(_metricsBuffer) - 1; length && _metricsBuffer[length - 1] != '\n'; --length)
+        ;
+    }
+
+    return length;
+  }
+
+  // the file is replaced atomically so that scrapers never see partial text
+  void writeMetricsFile()
+  {
+    char path[sizeof(_metricsPath) + 4];
+    snprintf(path, sizeof(path), "%s.tmp", _metricsPath);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0)
+      return;
+
+    size_t length = renderMetrics();
+    bool written = true;
+
+    for (size_t offset = 0; written && offset < length;)
+    {
+      ssize_t n = write(fd, _metricsBuffer + offset, length - offset);
+
+      if (n < 0 && errno == EINTR)
+        continue;
+
+      written = n > 0;
+      offset += written ? static_cast<size_t>(n) : 0;
+    }
+
+    close(fd);
+
+    if (!written || rename(path, _metricsPath) != 0)
+      unlink(path);
+  }
+
+  // answers any request with the metrics, HTTP/1.0 style
+  void serveMetricsClient(int fd)
+  {
+    char request[1024];
+    size_t length = 0;
+
+    while (length < sizeof(request) - 1)
+    {
+      ssize_t n = recv(fd, request + length, sizeof(request) - 1 - length, 0);
+
+      if (n < 0 && errno == EINTR)
+        continue;
+
+      if (n <= 0)
+        return;
+
+      length += static_cast<size_t>(n);
+      request[length] = 0;
+
+      if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+        break;
+    }
+
+    size_t body = renderMetrics();
+    reply(fd, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n", static_cast<unsigned long>(body));
+    sendAll(fd, _metricsBuffer, body);
+  }
+
+  void* serveMetrics(void*)
+  {
+    bool readable = false;
+    int64_t next = 0;
+    int timeout;
+
+    do
+    {
+      if (readable)
+      {
+        int client = accept(_metricsSocket, PPK_ASSERT_NULLPTR, PPK_ASSERT_NULLPTR);
+
+        if (client >= 0)
+        {
+          struct timeval receive = {1, 0};
+          setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &receive, sizeof(receive));
+#if defined(SO_NOSIGPIPE)
+          int one = 1;
+          setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+          serveMetricsClient(client);
+          close(client);
+        }
+      }
+
+      timeout = -1;
+
+      if (*_metricsPath)
+      {
+        int64_t now = monotonicTime() / 1000;
+
+        if (now >= next)
+        {
+          writeMetricsFile();
+          next = now + _metricsInterval;
+        }
+
+        timeout = static_cast<int>(next - now);
+      }
+    }
+    while (waitService(_metricsService, _metricsSocket, timeout, &readable));
+
+    // leave up to date metrics behind
+    if (*_metricsPath)
+      writeMetricsFile();
+
+    return PPK_ASSERT_NULLPTR;
+  }
+
+  Service _statsdService;
+  int _statsdSocket = -1;
+  char _statsdPrefix[64];
+  int _statsdInterval;
+  volatile long _statsdLock = 0;
+  char _statsdDatagram[PPK_ASSERT_STATSD_DATAGRAM_SIZE];
+
+  // metric names only keep characters all StatsD implementations accept
+  void writeMetricName(char* buffer, size_t size, const char* s)
+  {
+    size_t length = 0;
+
+    for (; *s && length + 1 < size; ++s)
+    {
+      char c = *s;
+      bool valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-';
+      buffer[length++] = valid ? c : '_';
+    }
+
+    buffer[length] = 0;
+  }
+
+  // send errors are ignored, the datagram is lost if the agent is down
+  void sendStatsdDatagram(size_t length)
+  {
+#if defined(MSG_DONTWAIT)
+    const int flags = MSG_DONTWAIT;
+#else
+    const int flags = 0; // the socket is non-blocking
+#endif
+
+    if (length)
+      (void)!send(_statsdSocket, _statsdDatagram, length, flags);
+  }
+
+  // sends the failures that happened since the previous flush, batching as
+  // many counters per datagram as possible
+  void flushStatsd()
+  {
+    SpinLock lock(&_statsdLock);
+
+    if (_statsdSocket < 0)
+      return;
+
+    size_t length = 0;
+
+    for (unsigned long i = 0; i < PPK_ASSERT_SITE_TABLE_SIZE; ++i)
+    {
+      Site& site = _sites[i];
+
+      if (!atomicLoad(&site.ready))
+        continue;
+
+      long failures = atomicLoad(&site.failures);
+      long delta = failures - site.statsdSent;
+
+      if (!delta)
+        continue;
+
+      const char* levelstr = levelString(site.level);
+      char level[16];
+      char file[96];
+      char metric[256];
+
+      if (levelstr)
+      {
+        size_t j = 0;
+        for (; levelstr[j] && j + 1 < sizeof(level); ++j)
+          level[j] = static_cast<char>(levelstr[j] - 'A' + 'a'); // level names are upper case letters
+
+        level[j] = 0;
+      }
+      else
+      {
+        snprintf(level, sizeof(level), "level_%d", site.level);
+      }
+
+      writeMetricName(file, sizeof(file), site.file);
+
+      int n = snprintf(metric, sizeof(metric), "%s%sfailures.%s.%s.%d:%ld|c\n", _statsdPrefix, *_statsdPrefix ? "." : "", level, file, site.line, delta);
+
+      if (n <= 0 || static_cast<size_t>(n) >= sizeof(metric))
+        continue;
+
+      if (length + static_cast<size_t>(n) > sizeof(_statsdDatagram))
+      {
+        sendStatsdDatagram(length);
+        length = 0;
+      }
+
+      memcpy(_statsdDatagram + length, metric, static_cast<size_t>(n));
+      length += static_cast<size_t>(n);
+      site.statsdSent = failures;
+    }
+
+    sendStatsdDatagram(length);
+  }
+
+  void* serveStatsd(void*)
+  {
+    bool readable;
+
+    while (waitService(_statsdService, -1, _statsdInterval, &readable))
+      flushStatsd();
+
+    flushStatsd();
+
+    return PPK_ASSERT_NULLPTR;
+  }
+
+  // bounded multiple producers queue (Vyukov), a slot is ready to be written
+  // when its sequence equals the enqueue position and ready to be read when it
+  // equals the dequeue position + 1, Size must be a power of 2
+  template <typename T, long Size>
+  struct BoundedQueue
+  {
+    struct Slot
+    {
+      volatile long sequence;
+      T item;
+    };
+
+    Slot slots[Size];
+    volatile long enqueue;
+    long dequeue; // only used by the consumer thread
+    volatile long dropped;
+    bool initialized;
+  };
+
+  template <typename T, long Size>
+  void initializeQueue(BoundedQueue<T, Size>& queue)
+  {
+    if (queue.initialized)
+      return;
+
+    for (long i = 0; i < Size; ++i)
+      queue.slots[i].sequence = i;
+
+    queue.initialized = true;
+  }
+
+  // never waits, the item is dropped when the queue is full
+  template <typename T, long Size>
+  bool enqueue(BoundedQueue<T, Size>& queue, const T& item)
+  {
+    long position = atomicLoad(&queue.enqueue);
+    typename BoundedQueue<T, Size>::Slot* slot;
+
+    for (;;)
+    {
+      slot = &queue.slots[position & (Size - 1)];
+      long difference = atomicLoad(&slot->sequence) - position;
+
+      if (difference == 0 && atomicCompareExchange(&queue.enqueue, position, position + 1))
+        break;
+
+      if (difference < 0)
+      {
+        atomicAdd(&queue.dropped, 1);
+        return false;
+      }
+
+      position = atomicLoad(&queue.enqueue);
+    }
+
+    slot->item = item;
+    atomicStore(&slot->sequence, position + 1);
+
+    return true;
+  }
+
+  template <typename T, long Size>
+  bool dequeue(BoundedQueue<T, Size>& queue, T& item)
+  {
+    typename BoundedQueue<T, Size>::Slot& slot = queue.slots[queue.dequeue & (Size - 1)];
+
+    if (atomicLoad(&slot.sequence) != queue.dequeue + 1)
+      return false;
+
+    item = slot.item;
+    atomicStore(&slot.sequence, queue.dequeue + Size);
+    ++queue.dequeue;
+
+    return true;
+  }
+
+  PPK_STATIC_ASSERT((PPK_ASSERT_SHIPPER_QUEUE_SIZE & (PPK_ASSERT_SHIPPER_QUEUE_SIZE - 1)) == 0, "PPK_ASSERT_SHIPPER_QUEUE_SIZE must be a power of 2");
+
+  BoundedQueue<implementation::EventRecord, PPK_ASSERT_SHIPPER_QUEUE_SIZE> _shipperQueue;
+  volatile long _shipperEnabled = 0;
+
+  Service _shipperService;
+  char _shipperAddress[256];
+  int _shipperInterval;
+
+  // encoded frames waiting to be sent, only used by the shipper thread
+  unsigned char _shipperBatch[16384];
+  size_t _shipperLength = 0;
+
+  unsigned char* encodeInteger(unsigned char* p, uint64_t value, int size)
+  {
+    for (int i = 0; i < size; ++i)
+      *p++ = static_cast<unsigned char>(value >> (8 * i));
+
+    return p;
+  }
+
+  unsigned char* encodeString(unsigned char* p, const char* s, size_t size)
+  {
+    size_t length = strnlen(s, size);
+    p = encodeInteger(p, length, 2);
+    memcpy(p, s, length);
+
+    return p + length;
+  }
+
+  // see PPK_ASSERT_SHIPPER_MAGIC for the framing, returns the frame size
+  size_t encodeFrame(unsigned char* frame, const implementation::EventRecord& event)
+  {
+    unsigned char* p = frame + 4;
+
+    p = encodeInteger(p, static_cast<uint64_t>(event.time), 8);
+    p = encodeInteger(p, event.threadId, 8);
+    p = encodeInteger(p, static_cast<uint32_t>(event.processId), 4);
+    p = encodeInteger(p, static_cast<uint32_t>(event.line), 4);
+    p = encodeInteger(p, static_cast<uint32_t>(event.level), 4);
+
+    for (int i = 0; i < PPK_ASSERT_CORRELATION_WORDS; ++i)
+      p = encodeInteger(p, event.correlation[i], 8);
+
+    p = encodeInteger(p, event.taskId, 8);
+
+    p = encodeString(p, event.file, sizeof(event.file));
+    p = encodeString(p, event.function, sizeof(event.function));
+    p = encodeString(p, event.expression, sizeof(event.expression));
+    p = encodeString(p, event.message, sizeof(event.message));
+
+    size_t size = static_cast<size_t>(p - frame);
+    encodeInteger(frame, size - 4, 4);
+
+    return size;
+  }
+
+  // the address is either the path of a Unix domain socket or host:port
+  int connectShipper()
+  {
+    int fd = -1;
+
+    if (_shipperAddress[0] == '/')
+    {
+      struct sockaddr_un address;
+
+      if (strlen(_shipperAddress) >= sizeof(address.sun_path))
+        return -1;
+
+      memset(&address, 0, sizeof(address));
+      address.sun_family = AF_UNIX;
+      memcpy(address.sun_path, _shipperAddress, strlen(_shipperAddress));
+
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+      if (fd >= 0 && connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0)
+      {
+        close(fd);
+        fd = -1;
+      }
+    }
+    else
+    {
+      char host[sizeof(_shipperAddress)];
+      copyString(host, sizeof(host), _shipperAddress);
+
+      char* port = strrchr(host, ':');
+
+      if (!port)
+        return -1;
+
+      *port++ = 0;
+
+      struct addrinfo hints;
+      memset(&hints, 0, sizeof(hints));
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+
+      struct addrinfo* addresses;
+
+      if (getaddrinfo(host, port, &hints, &addresses) != 0)
+        return -1;
+
+      for (struct addrinfo* address = addresses; address && fd < 0; address = address->ai_next)
+      {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+        if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) != 0)
+        {
+          close(fd);
+          fd = -1;
+        }
+      }
+
+      freeaddrinfo(addresses);
+    }
+
+    if (fd < 0)
+      return -1;
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    // a stalled collector mustn't prevent stopEventShipper() from returning
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#if defined(SO_NOSIGPIPE)
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+    if (!sendAll(fd, PPK_ASSERT_SHIPPER_MAGIC, 8))
+    {
+      close(fd);
+      return -1;
+    }
+
+    return fd;
+  }
+
+  // sends the batch, on failure only keeps the frames that weren't fully sent
+  bool sendShipperBatch(int fd)
+  {
+#if defined(MSG_NOSIGNAL)
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+
+    size_t sent = 0;
+
+    while (sent < _shipperLength)
+    {
+      ssize_t n = send(fd, _shipperBatch + sent, _shipperLength - sent, flags);
+
+      if (n < 0 && errno == EINTR)
+        continue;
+
+      if (n <= 0)
+        break;
+
+      sent += static_cast<size_t>(n);
+    }
+
+    if (sent == _shipperLength)
+    {
+      _shipperLength = 0;
+      return true;
+    }
+
+    size_t frame = 0;
+
+    for (;;)
+    {
+      size_t next = frame + 4 + (_shipperBatch[frame] | _shipperBatch[frame + 1] << 8 | _shipperBatch[frame + 2] << 16 | static_cast<size_t>(_shipperBatch[frame + 3]) << 24);
+
+      if (next > sent)
+        break;
+
+      frame = next;
+    }
+
+    memmove(_shipperBatch, _shipperBatch + frame, _shipperLength - frame);
+    _shipperLength -= frame;
+
+    return false;
+  }
+
+  void* serveShipper(void*)
+  {
+    const size_t frameSize = 4 + 28 + 8 * PPK_ASSERT_CORRELATION_WORDS + 8 + 4 * 2 + sizeof(implementation::EventRecord().file) + sizeof(implementation::EventRecord().function)
+                           + sizeof(implementation::EventRecord().expression) + sizeof(implementation::EventRecord().message);
+
+    int fd = -1;
+    int backoff = 0;
+    int64_t retry = 0;
+    bool stopping = false;
+    bool readable;
+
+    while (!stopping)
+    {
+      stopping = !waitService(_shipperService, -1, _shipperInterval, &readable);
+
+      if (fd < 0)
+      {
+        int64_t now = monotonicTime() / 1000;
+
+        if (now < retry && !stopping)
+          continue;
+
+        fd = connectShipper();
+
+        if (fd < 0)
+        {
+          backoff = backoff ? backoff * 2 : 100;
+          backoff = backoff < PPK_ASSERT_SHIPPER_MAX_BACKOFF ? backoff : PPK_ASSERT_SHIPPER_MAX_BACKOFF;
+          retry = now + backoff;
+          continue;
+        }
+
+        backoff = 0;
+      }
+
+      implementation::EventRecord event;
+
+      for (;;)
+      {
+        while (_shipperLength + frameSize <= sizeof(_shipperBatch) && dequeue(_shipperQueue, event))
+          _shipperLength += encodeFrame(_shipperBatch + _shipperLength, event);
+
+        if (!_shipperLength)
+          break;
+
+        if (!sendShipperBatch(fd))
+        {
+          close(fd);
+          fd = -1;
+          break;
+        }
+      }
+    }
+
+    if (fd >= 0)
+      close(fd);
+
+    return PPK_ASSERT_NULLPTR;
+  }
+
+  PPK_STATIC_ASSERT((PPK_ASSERT_DISPATCH_QUEUE_SIZE & (PPK_ASSERT_DISPATCH_QUEUE_SIZE - 1)) == 0, "PPK_ASSERT_DISPATCH_QUEUE_SIZE must be a power of 2");
+
+  struct DispatchedEvent
+  {
+    implementation::EventRecord event;
+    implementation::AssertHandler handler; // the process wide one
+    bool* ignoreLine;
+  };
+
+  BoundedQueue<DispatchedEvent, PPK_ASSERT_DISPATCH_QUEUE_SIZE> _dispatchQueue;
+  volatile long _dispatchEnabled = 0;
+
+  Service _dispatchService;
+  int _dispatchWakeup[2] = {-1, -1}; // non blocking, written once per queued event
+
+  // never waits, the event is dropped when the queue is full
+  void dispatchEvent(const implementation::EventRecord& event, implementation::AssertHandler handler, bool* ignoreLine)
+  {
+    DispatchedEvent dispatched;
+    dispatched.event = event;
+    dispatched.handler = handler;
+    dispatched.ignoreLine = ignoreLine;
+
+    if (enqueue(_dispatchQueue, dispatched))
+      (void)!write(_dispatchWakeup[1], "", 1); // when the pipe is full, the worker is awake already
+  }
+
+  // only the IgnoreLine, IgnoreAll and Abort answers still make sense once the
+  // failing thread moved on
+  void handleDispatchedEvent(const DispatchedEvent& dispatched)
+  {
+    namespace AssertAction = implementation::AssertAction;
+
+    const implementation::EventRecord& event = dispatched.event;
+    ReentrancyGuard guard; // assertions fired by the handler are nested
+
+    _currentEvent = &event;
+    notifySubscribers(event);
+
+    int64_t start = monotonicTime();
+    AssertAction::AssertAction action = dispatched.handler(event.file, event.line, event.function, event.expression, event.level, event.message[0] ? event.message : PPK_ASSERT_NULLPTR);
+    recordHandlerTime(monotonicTime() - start);
+    _currentEvent = PPK_ASSERT_NULLPTR;
+
+    switch (action)
+    {
+      case AssertAction::Abort:
+        PPK_ASSERT_ABORT();
+
+#if !defined(PPK_ASSERT_DISABLE_IGNORE_LINE)
+      case AssertAction::IgnoreLine:
+        storeLineIgnored(dispatched.ignoreLine, true);
+        break;
+#endif
+
+      case AssertAction::IgnoreAll:
+        implementation::ignoreAllAsserts(true);
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  void* serveDispatch(void*)
+  {
+    DispatchedEvent dispatched;
+    bool stopping = false;
+    bool readable;
+
+    while (!stopping)
+    {
+      stopping = !waitService(_dispatchService, _dispatchWakeup[0], -1, &readable);
+
+      char buffer[256];
+      while (read(_dispatchWakeup[0], buffer, sizeof(buffer)) > 0);
+
+      // drained after the wakeup pipe so that no event is left behind
+      while (dequeue(_dispatchQueue, dispatched))
+        handleDispatchedEvent(dispatched);
+    }
+
+    return PPK_ASSERT_NULLPTR;
+  }
+
+  // writes the digits of magnitude backwards from end, zero padded up to
+  // width digits, returns the first digit
+  char* formatSignalNumber(char* begin, char* end, uint64_t magnitude, unsigned base, int width, bool upper)
+  {
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char* p = end;
+
+    for (int count = 1; p > begin; ++count)
+    {
+      *--p = digits[magnitude % base];
+      magnitude /= base;
+
+      if (!magnitude && count >= width)
+        break;
+    }
+
+    return p;
+  }
+
+  // async-signal-safe formatting, snprintf() isn't
+  struct SignalWriter
+  {
+    int fd;
+    size_t length;
+    char buffer[512];
+  };
+
+  void flushSignalWriter(SignalWriter& writer)
+  {
+    for (size_t offset = 0; offset < writer.length;)
+    {
+      ssize_t n = write(writer.fd, writer.buffer + offset, writer.length - offset);
+
+      if (n < 0 && errno == EINTR)
+        continue;
+
+      if (n <= 0)
+        break;
+
+      offset += static_cast<size_t>(n);
+    }
+
+    writer.length = 0;
+  }
+
+  void writeSignalString(SignalWriter& writer, const char* s)
+  {
+    for (; *s; ++s)
+    {
+      if (writer.length == sizeof(writer.buffer))
+        flushSignalWriter(writer);
+
+      writer.buffer[writer.length++] = *s;
+    }
+  }
+
+  // zero pads the number up to width digits
+  void writeSignalNumber(SignalWriter& writer, int64_t value, int width)
+  {
+    char digits[24];
+    uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+
+    digits[sizeof(digits) - 1] = 0;
+    char* p = formatSignalNumber(digits + 1, digits + sizeof(digits) - 1, magnitude, 10, width, false);
+
+    if (value < 0)
+      *--p = '-';
+
+    writeSignalString(writer, p);
+  }
+
+  void writeSignalEvent(SignalWriter& writer, const implementation::EventRecord& event)
+  {
+    writeSignalNumber(writer, event.time / 1000000, 0);
+    writeSignalString(writer, ".");
+    writeSignalNumber(writer, event.time % 1000000, 6);
+    writeSignalString(writer, " [");
+    writeSignalNumber(writer, event.processId, 0);
+    writeSignalString(writer, ":");
+    writeSignalNumber(writer, static_cast<int64_t>(event.threadId), 0);
+    writeSignalString(writer, "] Assertion '");
+    writeSignalString(writer, event.expression);
+    writeSignalString(writer, "' failed (");
+
+    if (const char* level = levelString(event.level))
+    {
+      writeSignalString(writer, level);
+    }
+    else
+    {
+      writeSignalString(writer, "level = ");
+      writeSignalNumber(writer, event.level, 0);
+    }
+
+    writeSignalString(writer, ") in file ");
+    writeSignalString(writer, event.file);
+    writeSignalString(writer, ", line ");
+    writeSignalNumber(writer, event.line, 0);
+    writeSignalString(writer, ", function: ");
+    writeSignalString(writer, event.function);
+
+    if (*event.message)
+    {
+      writeSignalString(writer, ", with message: ");
+      writeSignalString(writer, event.message);
+    }
+
+    writeSignalString(writer, "\n");
+  }
+
+  void appendSignalString(char* buffer, size_t size, size_t& length, const char* s)
+  {
+    for (; *s && length + 1 < size; ++s)
+      buffer[length++] = *s;
+  }
+
+  void appendSignalFloat(char* buffer, size_t size, size_t& length, double value, int precision)
+  {
+    char digits[32];
+    digits[sizeof(digits) - 1] = 0;
+
+    if (value != value)
+    {
+      appendSignalString(buffer, size, length, "nan");
+      return;
+    }
+
+    if (value < 0)
+    {
+      appendSignalString(buffer, size, length, "-");
+      value = -value;
+    }
+
+    int exponent = 0;
+
+    while (value >= 1e18 && exponent < 400)
+    {
+      value /= 10;
+      ++exponent;
+    }
+
+    if (exponent >= 400)
+    {
+      appendSignalString(buffer, size, length, "inf");
+      return;
+    }
+
+    uint64_t scale = 1;
+    for (int i = 0; i < precision; ++i)
+      scale *= 10;
+
+    uint64_t integer = static_cast<uint64_t>(value);
+    uint64_t fraction = static_cast<uint64_t>((value - static_cast<double>(integer)) * static_cast<double>(scale) + 0.5);
+
+    if (fraction >= scale) // rounded up
+    {
+      ++integer;
+      fraction -= scale;
+    }
+
+    appendSignalString(buffer, size, length, formatSignalNumber(digits, digits + sizeof(digits) - 1, integer, 10, 1, false));
+
+    if (precision > 0)
+    {
+      appendSignalString(buffer, size, length, ".");
+      appendSignalString(buffer, size, length, formatSignalNumber(digits, digits + sizeof(digits) - 1, fraction, 10, precision, false));
+    }
+
+    if (exponent)
+    {
+      appendSignalString(buffer, size, length, "e+");
+      appendSignalString(buffer, size, length, formatSignalNumber(digits, digits + sizeof(digits) - 1, static_cast<uint64_t>(exponent), 10, 2, false));
+    }
+  }
+
+  // async-signal-safe subset of vsnprintf(): flags and width are ignored,
+  // precision is only honored by string and floating point conversions
+  void formatSignalSafe(char* buffer, size_t size, const char* format, va_list args)
+  {
+    size_t length = 0;
+    char digits[32];
+    digits[sizeof(digits) - 1] = 0;
+    char* end = digits + sizeof(digits) - 1;
+
+    for (const char* p = format; *p && length + 1 < size; ++p)
+    {
+      if (*p != '%')
+      {
+        buffer[length++] = *p;
+        continue;
+      }
+
+      if (*++p == '%')
+      {
+        buffer[length++] = '%';
+        continue;
+      }
+
+      while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0')
+        ++p;
+
+      if (*p == '*')
+      {
+        (void)va_arg(args, int);
+        ++p;
+      }
+
+      while (*p >= '0' && *p <= '9')
+        ++p;
+
+      int precision = -1;
+
+      if (*p == '.')
+      {
+        precision = 0;
+
+        if (*++p == '*')
+        {
+          precision = va_arg(args, int);
+          ++p;
+        }
+
+        for (; *p >= '0' && *p <= '9'; ++p)
+          precision = precision * 10 + (*p - '0');
+      }
+
+      int longs = 0;
+      bool wide = false; // size_t, ptrdiff_t and intmax_t
+      bool longDouble = false;
+
+      for (;; ++p)
+      {
+        if (*p == 'l')
+          ++longs;
+        else if (*p == 'z' || *p == 't' || *p == 'j')
+          wide = true;
+        else if (*p == 'L')
+          longDouble = true;
+        else if (*p != 'h')
+          break;
+      }
+
+      switch (*p)
+      {
+        case 'd':
+        case 'i':
+        {
+          int64_t value = longs > 1 || wide ? va_arg(args, int64_t) : longs ? va_arg(args, long) : va_arg(args, int);
+
+          if (value < 0)
+            appendSignalString(buffer, size, length, "-");
+
+          appendSignalString(buffer, size, length, formatSignalNumber(digits, end, value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value), 10, 1, false));
+          break;
+        }
+
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        {
+          uint64_t value = longs > 1 || wide ? va_arg(args, uint64_t) : longs ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+          unsigned base = *p == 'u' ? 10 : *p == 'o' ? 8 : 16;
+
+          appendSignalString(buffer, size, length, formatSignalNumber(digits, end, value, base, 1, *p == 'X'));
+          break;
+        }
+
+        case 'p':
+          appendSignalString(buffer, size, length, "0x");
+          appendSignalString(buffer, size, length, formatSignalNumber(digits, end, static_cast<uint64_t>(reinterpret_cast<uintptr_t>(va_arg(args, void*))), 16, 1, false));
+          break;
+
+        case 'c':
+          buffer[length++] = static_cast<char>(va_arg(args, int));
+          break;
+
+        case 's':
+        {
+          const char* value = va_arg(args, const char*);
+          value = value ? value : "(null)";
+
+          // with a precision, the string doesn't have to be null terminated
+          for (int i = 0; (precision < 0 || i < precision) && value[i] && length + 1 < size; ++i)
+            buffer[length++] = value[i];
+
+          break;
+        }
+
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+        {
+          double value = longDouble ? static_cast<double>(va_arg(args, long double)) : va_arg(args, double);
+          appendSignalFloat(buffer, size, length, value, precision < 0 ? 6 : precision > 9 ? 9 : precision);
+          break;
+        }
+
+        case 'n':
+          (void)va_arg(args, void*);
+          break;
+
+        default:
+          if (!*p)
+            --p; // let the loop stop
+
+          break;
+      }
+    }
+
+    buffer[length] = 0;
+  }
+
+  // reports a failed assertion without calling the assertion handler, the
+  // action only depends on the level since the user can't be prompted, and
+  // throwing isn't async-signal-safe. DEBUG failures don't break, a debug trap
+  // without a debugger attached kills the process
+  AssertAction::AssertAction reportSignalSafe(const implementation::EventRecord& event)
+  {
+    SignalWriter writer;
+    writer.fd = STDERR_FILENO;
+    writer.length = 0;
+
+    writeSignalString(writer, "*** signal-safe ");
+    writeSignalEvent(writer, event);
+    flushSignalWriter(writer);
+
+#if defined(PPK_ASSERT_LOG_FILE)
+    writer.fd = open(PPK_ASSERT_LOG_FILE, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if (writer.fd >= 0)
+    {
+      writeSignalString(writer, "*** signal-safe ");
+      writeSignalEvent(writer, event);
+      flushSignalWriter(writer);
+      close(writer.fd);
+    }
+#endif
+
+    return event.level < AssertLevel::Error ? AssertAction::None : AssertAction::Abort;
+  }
+
+  volatile long _forkedMultithreaded = 0;
+
+  // returns false when unknown. It runs before every fork(), so it reads the
+  // thread count with a few syscalls instead of listing /proc/self/task
+  bool isSingleThreaded()
+  {
+#if defined(__linux__)
+    int fd = open("/proc/self/stat", O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+      return false;
+
+    char buffer[1024];
+    ssize_t n = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+
+    if (n <= 0)
+      return false;
+
+    buffer[n] = 0;
+
+    // the command name may contain spaces, num_threads is the 18th field
+    // after the closing parenthesis
+    const char* p = strrchr(buffer, ')');
+
+    for (int i = 0; p && i < 18; ++i)
+      p = strchr(p + 1, ' ');
+
+    return p && p[1] == '1' && p[2] == ' ';
+#else
+    return false;
+#endif
+  }
+
+  void prepareFork()
+  {
+    atomicStore(&_forkedMultithreaded, isSingleThreaded() ? 0 : 1);
+  }
+
+  // the child of a multithreaded process may only call async-signal-safe
+  // functions until it calls exec(), only the thread that forked survives
+  void enterForkedChild()
+  {
+    _threadId = 0;
+    atomicStore(&_processId, 0);
+
+    if (atomicLoad(&_forkedMultithreaded))
+      ppk::assert::implementation::signalSafeAsserts(true);
+  }
+
+  struct ForkHandlers
+  {
+    ForkHandlers()
+    {
+      pthread_atfork(prepareFork, PPK_ASSERT_NULLPTR, enterForkedChild);
+    }
+  };
+
+  ForkHandlers _forkHandlers;
+
+  const int _crashSignals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+  struct sigaction _crashPrevious[sizeof(_crashSignals) / sizeof(_crashSignals[0])];
+  char _crashPath[1024];
+
+  void crashHandler(int signal)
+  {
+    int fd = *_crashPath ? open(_crashPath, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644) : STDERR_FILENO;
+
+    if (fd >= 0)
+    {
+      SignalWriter writer;
+      writer.fd = fd;
+      writer.length = 0;
+
+      writeSignalString(writer, "*** received signal ");
+      writeSignalNumber(writer, signal, 0);
+      writeSignalString(writer, ", last failed assertions:\n");
+      flushSignalWriter(writer);
+
+      ppk::assert::implementation::dumpFlightRecorder(fd);
+
+      if (fd != STDERR_FILENO)
+        close(fd);
+    }
+
+    // chain to the previous handler, or let the default action kill the process
+    for (size_t i = 0; i < sizeof(_crashSignals) / sizeof(_crashSignals[0]); ++i)
+    {
+      if (_crashSignals[i] == signal)
+        sigaction(signal, &_crashPrevious[i], PPK_ASSERT_NULLPTR);
+    }
+
+    raise(signal);
+  }
+#endif
+
+  // writes one line without allocating or taking locks
+  void reportNested(const char* file, int line, const char* expression)
+  {
+#if !defined(_WIN32)
+    SignalWriter writer;
+    writer.fd = STDERR_FILENO;
+    writer.length = 0;
+
+    writeSignalString(writer, "*** nested assertion '");
+    writeSignalString(writer, expression);
+    writeSignalString(writer, "' failed in file ");
+    writeSignalString(writer, file);
+    writeSignalString(writer, ", line ");
+    writeSignalNumber(writer, line, 0);
+    writeSignalString(writer, "\n");
+    flushSignalWriter(writer);
+#else
+    fprintf(stderr, "*** nested assertion '%s' failed in file %s, line %d\n", expression, file, line);
+#endif
+  }
+
+  AssertAction::AssertAction PPK_ASSERT_CALL _defaultHandler( const char* file,
+                                                              int line,
+                                                              const char* function,
+                                                              const char* expression,
+                                                              int level,
+                                                              const char* message)
+  {
+#if defined(_WIN32)
+    if (::GetConsoleWindow() == NULL)
+    {
+      if (::AllocConsole())
+      {
+        (void)freopen("CONIN$", "r", stdin);
+        (void)freopen("CONOUT$", "w", stdout);
+        (void)freopen("CONOUT$", "w", stderr);
+
+        SetFocus(::GetConsoleWindow());
+      }
+    }
+#endif
+
+    formatLevel(level, expression, stderr, reinterpret_cast<printHandler>(print));
+    print(stderr, level, "  in file %s, line %d\n  function: %s\n", file, line, function);
+
+    if (message)
+      print(stderr, level, "  with message: %s\n\n", message);
+
+    // only the first failure of each distinct stack is symbolized
+    if (const ppk::assert::implementation::StackTrace* stack = ppk::assert::implementation::currentStackTrace())
+    {
+      if (stack->depth && stack->occurrences <= 1)
+      {
+        print(stderr, level, "  stack trace %08lx:\n", stack->hash);
+
+        for (int i = 0; i < stack->depth; ++i)
+          print(stderr, level, "    #%-2d %p in %s\n", i, stack->frames[i], ppk::assert::implementation::symbolize(stack->frames[i]));
+
+        print(stderr, level, "\n");
+      }
+      else if (stack->depth)
+      {
+        print(stderr, level, "  stack trace %08lx, seen %lu times\n\n", stack->hash, stack->occurrences);
+      }
+    }
+
+#if defined(PPK_ASSERT_HEAVY_HITTERS)
+    if (Site* site = findSite(hashSite(file, line, expression), file, line, expression))
+    {
+      if (site->hitters[0].count && site->hitters[1].count)
+      {
+        print(stderr, level, "  most frequent messages at this site:\n");
+        printHeavyHitters(*site, level, "    ");
+        print(stderr, level, "\n");
+      }
+    }
+#endif
+
+    if (level < AssertLevel::Debug)
+    {
+      return AssertAction::None;
+    }
+    else if (AssertLevel::Debug <= level && level < AssertLevel::Error)
+    {
+#if (!TARGET_OS_IPHONE && !TARGET_IPHONE_SIMULATOR) && (!defined(__ANDROID__) && !defined(ANDROID)) || defined(PPK_ASSERT_DEFAULT_HANDLER_STDIN)
+      if (!isInteractive())
+        return AssertAction::Ignore; // never block a server
+
+      for (;;)
+      {
+#if defined(PPK_ASSERT_DISABLE_IGNORE_LINE)
+        fprintf(stderr, "Press (I)gnore / Ignore (A)ll / (D)ebug / A(b)ort: ");
+#else
+        fprintf(stderr, "Press (I)gnore / Ignore (F)orever / Ignore (A)ll / (D)ebug / A(b)ort: ");
+#endif
+        fflush(stderr);
+
+        char buffer[256];
+        if (!fgets(buffer, sizeof(buffer), stdin))
+        {
+          bool closed = feof(stdin) != 0;
+
+          clearerr(stdin);
+          fprintf(stderr, "\n");
+          fflush(stderr);
+
+          if (closed) // nobody is going to answer
+            return AssertAction::Ignore;
+
+          continue;
+        }
+
+        // we eventually skip the leading spaces but that's it
+        char input[2] = {'b', 0};
+        if (sscanf(buffer, " %1[a-zA-Z] ", input) != 1)
+          continue;
+
+        switch (*input)
+        {
+          case 'b':
+          case 'B':
+            return AssertAction::Abort;
+
+          case 'd':
+          case 'D':
+            return AssertAction::Break;
+
+          case 'i':
+          case 'I':
+            return AssertAction::Ignore;
+
+#  if !defined(PPK_ASSERT_DISABLE_IGNORE_LINE)
+          case 'f':
+          case 'F':
+            return AssertAction::IgnoreLine;
+#  endif
+
+          case 'a':
+          case 'A':
+            return AssertAction::IgnoreAll;
+
+          default:
+            break;
+        }
+      }
+#else
+      return AssertAction::Break;
+#endif
+    }
+    else if (AssertLevel::Error <= level && level < AssertLevel::Fatal)
+    {
+      return AssertAction::Throw;
+    }
+
+    return AssertAction::Abort;
+  }
+
+  void _throw(const char* file,
+              int line,
+              const char* function,
+              const char* expression,
+              const char* message,
+              const implementation::StackTrace& stack)
+  {
+    using ppk::assert::implementation::throwException;
+    throwException(ppk::assert::AssertionException(file, line, function, expression, message, stack.frames, stack.depth));
+  }
+
+  size_t pageSize()
+  {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    ::GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+  }
+
+  // faults in the pages spanned by an object, zero pages of writable objects
+  // get their own frame thanks to an atomic no-op, returns false when locking
+  // them failed
+  bool warmPages(const void* begin, size_t size, bool writable, bool lock)
+  {
+    size_t page = pageSize();
+    uintptr_t start = reinterpret_cast<uintptr_t>(begin);
+    uintptr_t end = start + size;
+    uintptr_t first = start & ~static_cast<uintptr_t>(page - 1);
+
+    for (uintptr_t p = first; p < end; p += page)
+    {
+      uintptr_t q = p < start ? start : p;
+
+      if (!writable)
+      {
+        (void)*reinterpret_cast<const volatile char*>(q);
+        continue;
+      }
+
+      q = (q + sizeof(long) - 1) & ~static_cast<uintptr_t>(sizeof(long) - 1);
+
+      if (q + sizeof(long) <= end)
+        atomicAdd(reinterpret_cast<volatile long*>(q), 0);
+    }
+
+    if (!lock)
+      return true;
+
+#if defined(_WIN32)
+    return ::VirtualLock(reinterpret_cast<void*>(first), end - first) != 0;
+#else
+    return mlock(reinterpret_cast<void*>(first), end - first) == 0;
+#endif
+  }
+
+  template<typename F>
+  uintptr_t codeAddress(F f)
+  {
+    uintptr_t address = 0;
+    memcpy(&address, &f, sizeof(f) < sizeof(address) ? sizeof(f) : sizeof(address));
+
+    return address;
+  }
+
+  // handleAssert() and what it calls need a few kilobytes of stack
+  PPK_ASSERT_NOINLINE void warmStack()
+  {
+    volatile char stack[32768];
+
+    for (size_t i = 0; i < sizeof(stack); i += 256)
+      stack[i] = 0;
+  }
+
+  void warmFormat(char* buffer, size_t size, const char* format, ...)
+  {
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(buffer, size, format, args);
+    va_end(args);
+
+    va_start(args, format);
+    vfprintf(stderr, "%.0s", args); // prints nothing
+    fflush(stderr);
+    va_end(args);
+  }
+}
+
+namespace ppk {
+namespace assert {
+
+  AssertionException::AssertionException(const char* file,
+                                         int line,
+                                         const char* function,
+                                         const char* expression,
+                                         const char* message)
+  : _file(file), _line(line), _function(function), _expression(expression), _depth(0), _stackTrace(PPK_ASSERT_NULLPTR), _heap(PPK_ASSERT_NULLPTR)
+  {
+    setMessage(message);
+  }
+
+  AssertionException::AssertionException(const char* file,
+                                         int line,
+                                         const char* function,
+                                         const char* expression,
+                                         const char* message,
+                                         void* const* frames,
+                                         int depth)
+  : _file(file), _line(line), _function(function), _expression(expression), _depth(0), _stackTrace(PPK_ASSERT_NULLPTR), _heap(PPK_ASSERT_NULLPTR)
+  {
+    setMessage(message);
+    setStack(frames, depth);
+  }
+
+  AssertionException::AssertionException(const AssertionException& rhs)
+  : _file(rhs._file), _line(rhs._line), _function(rhs._function), _expression(rhs._expression), _depth(0), _stackTrace(PPK_ASSERT_NULLPTR)
+  {
+    setStack(rhs._frames, rhs._depth); // symbolized again lazily, symbols are cached anyway
+
+    const char* message = rhs.what();
+    size_t length = strlen(message);
+
+    if (length < size) // message is short enough for the stack buffer
+    {
+      memcpy(_stack, message, sizeof(char) * size); // pad with 0
+    }
+    else // allocate storage on the heap
+    {
+      _heap = static_cast<char*>(PPK_ASSERT_MALLOC(sizeof(char) * (length + 1)));
+
+      if (!_heap) // allocation failed
+      {
+        memcpy(_stack, message, sizeof(char) * (size - 1)); // stack fallback, truncate :/
+        _stack[size - 1] = 0;
+      }
+      else
+      {
+        memcpy(_heap, message, sizeof(char) * length); // copy the message
+        _heap[length] = 0;
+        _stack[size - 1] = 1; // mark the stack
+      }
+    }
+  }
+
+  void AssertionException::setMessage(const char* message)
+  {
+    if (!message)
+    {
+      memset(_stack, 0, sizeof(char) * size);
+      return;
+    }
+
+    size_t length = strlen(message);
+
+    if (length < size) // message is short enough for the stack buffer
+    {
+      memcpy(_stack, message, sizeof(char) * length);
+      memset(_stack + length, 0, sizeof(char) * (size - length)); // pad with 0
+    }
+    else // allocate storage on the heap
+    {
+      _heap = static_cast<char*>(PPK_ASSERT_MALLOC(sizeof(char) * (length + 1)));
+
+      if (!_heap) // allocation failed
+      {
+        memcpy(_stack, message, sizeof(char) * (size - 1)); // stack fallback, truncate :/
+        _stack[size - 1] = 0;
+      }
+      else
+      {
+        memcpy(_heap, message, sizeof(char) * length); // copy the message
+        _heap[length] = 0;
+        _stack[size - 1] = 1; // mark the stack
+      }
+    }
+  }
+
+  void AssertionException::setStack(void* const* frames, int depth)
+  {
+    if (_stackTrace)
+      PPK_ASSERT_FREE(_stackTrace);
+
+    _stackTrace = PPK_ASSERT_NULLPTR;
+    _depth = 0;
+
+#if PPK_ASSERT_EXCEPTION_STACK_DEPTH > 0
+    if (!frames || depth <= 0)
+      return;
+
+    _depth = depth < PPK_ASSERT_EXCEPTION_STACK_DEPTH ? depth : PPK_ASSERT_EXCEPTION_STACK_DEPTH;
+    memcpy(_frames, frames, sizeof(void*) * _depth);
+#else
+    PPK_ASSERT_UNUSED(frames);
+    PPK_ASSERT_UNUSED(depth);
+#endif
+  }
+
+  AssertionException::~AssertionException() PPK_ASSERT_EXCEPTION_NO_THROW
+  {
+    if (_stackTrace)
+      PPK_ASSERT_FREE(_stackTrace);
+
+    _stackTrace = PPK_ASSERT_NULLPTR;
+
+    if (_stack[size - 1])
+      PPK_ASSERT_FREE(_heap);
+
+    _heap = PPK_ASSERT_NULLPTR; // in case the exception object is destroyed twice
+    _stack[size - 1] = 0;
+  }
+
+  AssertionException& AssertionException::operator = (const AssertionException& rhs)
+  {
+    if (&rhs == this)
+      return *this;
+
+    setStack(rhs._frames, rhs._depth);
+
+    const char* message = rhs.what();
+    size_t length = strlen(message);
+
+    if (length < size) // message is short enough for the stack buffer
+    {
+      if (_stack[size - 1])
+        PPK_ASSERT_FREE(_heap);
+
+      memcpy(_stack, message, sizeof(char) * size);
+    }
+    else // allocate storage on the heap
+    {
+      if (_stack[size - 1])
+      {
+        size_t _length = strlen(_heap);
+
+        if (length <= _length)
+        {
+          memcpy(_heap, message, sizeof(char) * _length); // copy the message, pad with 0
+          return *this;
+        }
+        else
+        {
+          PPK_ASSERT_FREE(_heap);
+        }
+      }
+
+      _heap = static_cast<char*>(PPK_ASSERT_MALLOC(sizeof(char) * (length + 1)));
+
+      if (!_heap) // allocation failed
+      {
+        memcpy(_stack, message, sizeof(char) * (size - 1)); // stack fallback, truncate :/
         _stack[size - 1] = 0;
       }
-      else
+      else
+      {
+        memcpy(_heap, message, sizeof(char) * length); // copy the message
+        _heap[length] = 0;
+        _stack[size - 1] = 1; // mark the stack
+      }
+    }
+
+    _file = rhs._file;
+    _line = rhs._line;
+    _function = rhs._function;
+    _expression = rhs._expression;
+
+    return *this;
+  }
+
+  const char* AssertionException::what() const PPK_ASSERT_EXCEPTION_NO_THROW
+  {
+    return _stack[size - 1] ? _heap : _stack;
+  }
+
+  const char* AssertionException::stackTrace() const
+  {
+    if (_stackTrace)
+      return _stackTrace;
+
+    if (!_depth)
+      return "";
+
+    size_t length = 0;
+
+    for (int i = 0; i < _depth; ++i)
+      length += static_cast<size_t>(snprintf(PPK_ASSERT_NULLPTR, 0, "#%-2d %p in %s\n", i, _frames[i], implementation::symbolize(_frames[i])));
+
+    _stackTrace = static_cast<char*>(PPK_ASSERT_MALLOC(sizeof(char) * (length + 1)));
+
+    if (!_stackTrace) // allocation failed
+      return "";
+
+    size_t offset = 0;
+
+    for (int i = 0; i < _depth; ++i)
+      offset += static_cast<size_t>(snprintf(_stackTrace + offset, length + 1 - offset, "#%-2d %p in %s\n", i, _frames[i], implementation::symbolize(_frames[i])));
+
+    return _stackTrace;
+  }
+
+namespace implementation {
+
+  namespace {
+    volatile long _ignoreAll = 0;
+  }
+
+  void PPK_ASSERT_CALL ignoreAllAsserts(bool value)
+  {
+    atomicStore(&_ignoreAll, value);
+  }
+
+  bool PPK_ASSERT_CALL ignoreAllAsserts()
+  {
+    return atomicLoad(&_ignoreAll) != 0;
+  }
+
+  PPK_ASSERT_THREAD_LOCAL int _suppressLevel = 0;
+
+  int PPK_ASSERT_CALL setSuppressLevel(int level)
+  {
+    int previous = _suppressLevel;
+    _suppressLevel = level;
+
+    return previous;
+  }
+
+  int PPK_ASSERT_CALL suppressLevel()
+  {
+    return _suppressLevel;
+  }
+
+  PPK_ASSERT_THREAD_LOCAL uint64_t _correlation[PPK_ASSERT_CORRELATION_WORDS];
+
+  PPK_ASSERT_THREAD_LOCAL const Breadcrumb* _breadcrumbs = PPK_ASSERT_NULLPTR;
+  void PPK_ASSERT_CALL swapAssertContext(AssertContext& context)
+  {
+    uint64_t taskId = _taskId;
+    _taskId = context.taskId;
+    context.taskId = taskId;
+
+    for (int i = 0; i < PPK_ASSERT_CORRELATION_WORDS; ++i)
+    {
+      uint64_t word = _correlation[i];
+      _correlation[i] = context.correlation[i];
+      context.correlation[i] = word;
+    }
+
+    const Breadcrumb* breadcrumbs = _breadcrumbs;
+    _breadcrumbs = context.breadcrumbs;
+    context.breadcrumbs = breadcrumbs;
+  }
+
+#if defined(PPK_ASSERT_THREAD_LOCAL_CALLS)
+  void PPK_ASSERT_CALL setCorrelation(int index, uint64_t value)
+  {
+    assert(index >= 0 && index < PPK_ASSERT_CORRELATION_WORDS);
+    _correlation[index] = value;
+  }
+
+  uint64_t PPK_ASSERT_CALL correlation(int index)
+  {
+    assert(index >= 0 && index < PPK_ASSERT_CORRELATION_WORDS);
+    return _correlation[index];
+  }
+
+  const Breadcrumb* PPK_ASSERT_CALL setBreadcrumbs(const Breadcrumb* breadcrumbs)
+  {
+    const Breadcrumb* previous = _breadcrumbs;
+    _breadcrumbs = breadcrumbs;
+
+    return previous;
+  }
+
+  const Breadcrumb* PPK_ASSERT_CALL breadcrumbs()
+  {
+    return _breadcrumbs;
+  }
+#endif
+
+  namespace {
+    PPK_ASSERT_THREAD_LOCAL bool _signalSafe = false;
+  }
+
+  void PPK_ASSERT_CALL signalSafeAsserts(bool value)
+  {
+    _signalSafe = value;
+  }
+
+  bool PPK_ASSERT_CALL signalSafeAsserts()
+  {
+    return _signalSafe;
+  }
+
+  unsigned long PPK_ASSERT_CALL nestedFailures()
+  {
+    return static_cast<unsigned long>(atomicLoad(&_nestedFailures));
+  }
+
+  void PPK_ASSERT_CALL serverMode(bool value)
+  {
+    atomicStore(&_serverMode, value ? 1 : 0);
+  }
+
+  bool PPK_ASSERT_CALL serverMode()
+  {
+    return atomicLoad(&_serverMode) != 0;
+  }
+
+  HandlerTime PPK_ASSERT_CALL handlerTime()
+  {
+    HandlerTime time;
+    time.calls = static_cast<unsigned long>(atomicLoad(&_handlerCalls));
+    time.total = atomicLoad64(&_handlerTime);
+    time.max = atomicLoad64(&_handlerMaxTime);
+
+    return time;
+  }
+
+  bool PPK_ASSERT_CALL prewarm(bool lock)
+  {
+    // binds the symbols resolved lazily on first use
+    char buffer[512];
+    warmFormat(buffer, sizeof(buffer), "%s %d %3.3f %p", "prewarm", 1, 1.0, static_cast<void*>(buffer));
+    (void)strrchr(buffer, '/');
+    (void)currentTime();
+    (void)currentThreadId();
+
+#if defined(PPK_ASSERT_LOG_FILE)
+    if (FILE* f = fopen(PPK_ASSERT_LOG_FILE, "a"))
+      fclose(f);
+#endif
+
+#if defined(PPK_ASSERT_HAVE_BACKTRACE)
+    void* frames[2];
+    backtrace(frames, 2); // loads the unwinder
+#elif defined(_WIN32)
+    void* frames[2];
+    ::CaptureStackBackTrace(0, 2, frames, PPK_ASSERT_NULLPTR);
+#endif
+
+    describeAddress(reinterpret_cast<const void*>(codeAddress(&prewarm)), buffer, sizeof(buffer));
+
+    // thread local storage may be allocated on first access
+    (void)_currentStack;
+    (void)_assertDepth;
+    (void)_signalSafe;
+
+    warmStack();
+
+    bool locked = warmPages(_sites, sizeof(_sites), true, lock);
+    locked = warmPages(_stacks, sizeof(_stacks), true, lock) && locked;
+    locked = warmPages(_symbols, sizeof(_symbols), true, lock) && locked;
+    locked = warmPages(_symbolArena, sizeof(_symbolArena), true, lock) && locked;
+    locked = warmPages(_flightRecorder, sizeof(_flightRecorder), true, lock) && locked;
+    locked = warmPages(const_cast<long*>(&_stageBuckets[0][0][0]), sizeof(_stageBuckets), true, lock) && locked;
+#if !defined(_WIN32)
+    locked = warmPages(&_shipperQueue, sizeof(_shipperQueue), true, lock) && locked;
+    locked = warmPages(&_dispatchQueue, sizeof(_dispatchQueue), true, lock) && locked;
+#endif
+
+    // functions of this file are usually laid out next to each other
+    const uintptr_t functions[] =
+    {
+      codeAddress(&handleAssert),
+      codeAddress(&_defaultHandler),
+      codeAddress(&print),
+      codeAddress(&acquireSite),
+      codeAddress(&fillEventRecord),
+      codeAddress(&recordFlight),
+      codeAddress(&captureStack),
+      codeAddress(&_throw)
+    };
+
+    uintptr_t first = functions[0];
+    uintptr_t last = functions[0];
+
+    for (size_t i = 1; i < sizeof(functions) / sizeof(functions[0]); ++i)
+    {
+      first = functions[i] < first ? functions[i] : first;
+      last = functions[i] > last ? functions[i] : last;
+    }
+
+    if (last - first < 1024 * 1024) // otherwise the layout isn't what we expect
+      locked = warmPages(reinterpret_cast<const void*>(first), last - first + pageSize(), false, lock) && locked;
+
+    return locked;
+  }
+
+  namespace {
+    AssertHandler volatile _handler = _defaultHandler;
+    PPK_ASSERT_THREAD_LOCAL AssertHandler _threadHandler = PPK_ASSERT_NULLPTR; // takes precedence over _handler
+  }
+
+  AssertHandler PPK_ASSERT_CALL setAssertHandler(AssertHandler handler)
+  {
+    AssertHandler previous = atomicLoadPointer(&_handler);
+
+    atomicStorePointer(&_handler, handler ? handler : _defaultHandler);
+
+    return previous;
+  }
+
+  AssertHandler PPK_ASSERT_CALL setThreadAssertHandler(AssertHandler handler)
+  {
+    AssertHandler previous = _threadHandler;
+
+    _threadHandler = handler;
+
+    return previous;
+  }
+
+  bool PPK_ASSERT_CALL subscribe(AssertSubscriber subscriber, void* context)
+  {
+    if (!subscriber || _assertDepth > 0) // waiting for readers would deadlock
+      return false;
+
+    return updateSubscribers(subscriber, context, true);
+  }
+
+  bool PPK_ASSERT_CALL unsubscribe(AssertSubscriber subscriber, void* context)
+  {
+    if (!subscriber || _assertDepth > 0)
+      return false;
+
+    return updateSubscribers(subscriber, context, false);
+  }
+
+  int PPK_ASSERT_CALL heavyHitters(const char* file, int line, HeavyHitter* hitters, int count)
+  {
+#if defined(PPK_ASSERT_HEAVY_HITTERS)
+    file = baseName(file);
+
+    for (unsigned long i = 0; i < PPK_ASSERT_SITE_TABLE_SIZE; ++i)
+    {
+      Site& site = _sites[i];
+
+      if (atomicLoad(&site.ready) && site.line == line && strcmp(site.file, file) == 0)
+        return collectHeavyHitters(site, hitters, count);
+    }
+#else
+    PPK_ASSERT_UNUSED(file);
+    PPK_ASSERT_UNUSED(line);
+    PPK_ASSERT_UNUSED(hitters);
+    PPK_ASSERT_UNUSED(count);
+#endif
+
+    return 0;
+  }
+
+  void PPK_ASSERT_CALL dumpHeavyHitters()
+  {
+#if defined(PPK_ASSERT_HEAVY_HITTERS)
+    for (unsigned long i = 0; i < PPK_ASSERT_SITE_TABLE_SIZE; ++i)
+    {
+      Site& site = _sites[i];
+
+      if (!atomicLoad(&site.ready) || !site.hitters[0].count)
+        continue;
+
+      print(stderr, site.level, "Assertion '%s' in file %s, line %d failed %ld times, most frequent messages:\n", site.expression, site.file, site.line, atomicLoad(&site.failures));
+      printHeavyHitters(site, site.level, "  ");
+    }
+#endif
+  }
+
+  bool PPK_ASSERT_CALL openStatsFile(const char* path)
+  {
+#if !defined(_WIN32)
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    if (fd < 0)
+      return false;
+
+    StatsHeader* header = mapStatsTable(fd);
+    close(fd);
+
+    if (!header)
+      return false;
+
+    __atomic_store_n(&_statsFile, header, __ATOMIC_RELEASE);
+    return true;
+#else
+    PPK_ASSERT_UNUSED(path);
+    return false;
+#endif
+  }
+
+  bool PPK_ASSERT_CALL openStatsSegment(const char* name)
+  {
+#if defined(PPK_ASSERT_HAVE_SHM)
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+
+    if (fd < 0)
+      return false;
+
+    StatsHeader* header = mapStatsTable(fd);
+    close(fd);
+
+    if (!header)
+      return false;
+
+    __atomic_store_n(&_statsSegment, header, __ATOMIC_RELEASE);
+    return true;
+#else
+    PPK_ASSERT_UNUSED(name);
+    return false;
+#endif
+  }
+
+  bool PPK_ASSERT_CALL openEventSegment(const char* name)
+  {
+#if defined(PPK_ASSERT_HAVE_SHM)
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+
+    if (fd < 0)
+      return false;
+
+    EventsHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PPK_ASSERT_EVENTS_MAGIC, sizeof(header.magic));
+    header.version = PPK_ASSERT_EVENTS_VERSION;
+    header.rings = PPK_ASSERT_EVENT_RINGS;
+    header.ringSize = PPK_ASSERT_EVENT_RING_SIZE;
+    header.recordSize = sizeof(EventRecord);
+
+    const size_t size = sizeof(EventsHeader) + PPK_ASSERT_EVENT_RINGS * sizeof(EventRing);
+    EventsHeader* events = static_cast<EventsHeader*>(mapTable(fd, size, reinterpret_cast<const char*>(&header), sizeof(header)));
+    close(fd);
+
+    if (!events)
+      return false;
+
+    __atomic_store_n(&_eventSegment, events, __ATOMIC_RELEASE);
+    return true;
+#else
+    PPK_ASSERT_UNUSED(name);
+    return false;
+#endif
+  }
+
+  int PPK_ASSERT_CALL setAssertLevelThreshold(int level)
+  {
+    long previous = atomicLoad(&_levelThreshold);
+
+    while (!atomicCompareExchange(&_levelThreshold, previous, level))
+      previous = atomicLoad(&_levelThreshold);
+
+    return static_cast<int>(previous);
+  }
+
+  bool PPK_ASSERT_CALL startAdminServer(const char* path)
+  {
+#if !defined(_WIN32)
+    struct sockaddr_un address;
+
+    if (_adminSocket != -1 || strlen(path) >= sizeof(address.sun_path))
+      return false;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path, strlen(path));
+
+    // only replace a socket left behind by a previous instance
+    struct stat status;
+
+    if (lstat(path, &status) == 0 && !S_ISSOCK(status.st_mode))
+      return false;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0)
+      return false;
+
+    unlink(path);
+
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0)
+    {
+      close(fd);
+      return false;
+    }
+
+    // the admin interface controls the process, restrict it to its user
+    // before accepting connections rather than relying on the umask
+    if (chmod(path, 0600) != 0 || listen(fd, 4) != 0)
+    {
+      close(fd);
+      unlink(path);
+      return false;
+    }
+
+    _adminSocket = fd;
+
+    if (!startService(_adminService, serveAdmin))
+    {
+      closeAdminSocket();
+      return false;
+    }
+
+    return true;
+#else
+    PPK_ASSERT_UNUSED(path);
+    return false;
+#endif
+  }
+
+  void PPK_ASSERT_CALL stopAdminServer()
+  {
+#if !defined(_WIN32)
+    if (_adminSocket == -1)
+      return;
+
+    stopService(_adminService);
+    closeAdminSocket();
+#endif
+  }
+
+  size_t PPK_ASSERT_CALL writeMetrics(char* buffer, size_t size, int maxSites)
+  {
+    static const struct
+    {
+      const char* name;
+      const char* help;
+      volatile long Site::* counter;
+    } metrics[] =
+    {
+      {"ppk_assert_failures_total", "Failed assertions passed to the assertion handler.", &Site::failures},
+      {"ppk_assert_suppressed_total", "Failed assertions suppressed by a muted site or the level threshold.", &Site::suppressed},
+      {"ppk_assert_ignored_total", "Failed assertions the assertion handler chose to ignore.", &Site::ignored},
+      {"ppk_assert_thrown_total", "Failed assertions that threw an AssertionException.", &Site::thrown}
+    };
+
+    // sites beyond the cap are aggregated per standard level, custom levels
+    // share the last bucket
+    static const char* const levels[] = {"WARNING", "DEBUG", "ERROR", "FATAL", "other"};
+
+    TextWriter writer = {buffer, size, 0};
+
+    for (size_t m = 0; m < sizeof(metrics) / sizeof(metrics[0]); ++m)
+    {
+      long others[5] = {0};
+      bool overflow[5] = {false};
+
+      writeFormat(writer, "# HELP %s %s\n# TYPE %s counter\n", metrics[m].name, metrics[m].help, metrics[m].name);
+
+      for (unsigned long i = 0; i < PPK_ASSERT_SITE_TABLE_SIZE; ++i)
+      {
+        Site& site = _sites[i];
+
+        if (!atomicLoad(&site.ready))
+          continue;
+
+        long value = atomicLoad(&(site.*metrics[m].counter));
+
+        if (site.ordinal < maxSites)
+        {
+          const char* level = levelString(site.level);
+          char custom[16];
+
+          if (!level)
+          {
+            snprintf(custom, sizeof(custom), "%d", site.level);
+            level = custom;
+          }
+
+          writeSeries(writer, metrics[m].name, site.file, site.line, level, value);
+          continue;
+        }
+
+        size_t bucket = 4;
+        switch (site.level)
+        {
+          case AssertLevel::Warning: bucket = 0; break;
+          case AssertLevel::Debug: bucket = 1; break;
+          case AssertLevel::Error: bucket = 2; break;
+          case AssertLevel::Fatal: bucket = 3; break;
+        }
+
+        others[bucket] += value;
+        overflow[bucket] = true;
+      }
+
+      for (size_t b = 0; b < 5; ++b)
+      {
+        if (overflow[b])
+          writeSeries(writer, metrics[m].name, "other", 0, levels[b], others[b]);
+      }
+    }
+
+    writeFormat(writer, "# HELP ppk_assert_handler_seconds Time spent in the assertion handler, including waiting for the user.\n"
+                        "# TYPE ppk_assert_handler_seconds summary\nppk_assert_handler_seconds_sum %.6f\nppk_assert_handler_seconds_count %ld\n",
+                static_cast<double>(atomicLoad64(&_handlerTime)) / 1e6, atomicLoad(&_handlerCalls));
+    writeFormat(writer, "# HELP ppk_assert_handler_max_seconds Longest time spent in the assertion handler.\n"
+                        "# TYPE ppk_assert_handler_max_seconds gauge\nppk_assert_handler_max_seconds %.6f\n",
+                static_cast<double>(atomicLoad64(&_handlerMaxTime)) / 1e6);
+    writeFormat(writer, "# HELP ppk_assert_dispatch_latency_seconds Latency async dispatch adds to failing threads.\n"
+                        "# TYPE ppk_assert_dispatch_latency_seconds histogram\n");
+
+    long dispatched = 0;
+
+    for (int i = 0; i < PPK_ASSERT_DISPATCH_LATENCY_BUCKETS - 1; ++i)
+    {
+      dispatched += atomicLoad(&_dispatchBuckets[i]);
+      writeFormat(writer, "ppk_assert_dispatch_latency_seconds_bucket{le=\"%g\"} %ld\n", static_cast<double>(1 << i) / 1e6, dispatched);
+    }
+
+    dispatched += atomicLoad(&_dispatchBuckets[PPK_ASSERT_DISPATCH_LATENCY_BUCKETS - 1]);
+    writeFormat(writer, "ppk_assert_dispatch_latency_seconds_bucket{le=\"+Inf\"} %ld\nppk_assert_dispatch_latency_seconds_sum %.6f\nppk_assert_dispatch_latency_seconds_count %ld\n",
+                dispatched, static_cast<double>(atomicLoad64(&_dispatchTime)) / 1e6, dispatched);
+    writeFormat(writer, "# HELP ppk_assert_dispatch_dropped_total Failed assertions dropped because the dispatch queue was full.\n"
+                        "# TYPE ppk_assert_dispatch_dropped_total counter\nppk_assert_dispatch_dropped_total %lu\n", droppedDispatchedEvents());
+    writeFormat(writer, "# HELP ppk_assert_stage_seconds Time spent in each stage of handling failed assertions, on the failing thread.\n"
+                        "# TYPE ppk_assert_stage_seconds summary\n");
+
+    for (int level = 0; level < PPK_ASSERT_LATENCY_LEVELS; ++level)
+    {
+      for (int stage = 0; stage < AssertStage::Count; ++stage)
+      {
+        StageLatency latency = stageLatency(stage, _latencyLevels[level]);
+
+        if (!latency.count)
+          continue;
+
+        const char* labels = levelString(_latencyLevels[level]);
+        writeFormat(writer, "ppk_assert_stage_seconds{stage=\"%s\",level=\"%s\",quantile=\"0.5\"} %.9f\n", _stageNames[stage], labels, static_cast<double>(latencyPercentile(latency, 50)) / 1e9);
+        writeFormat(writer, "ppk_assert_stage_seconds{stage=\"%s\",level=\"%s\",quantile=\"0.99\"} %.9f\n", _stageNames[stage], labels, static_cast<double>(latencyPercentile(latency, 99)) / 1e9);
+        writeFormat(writer, "ppk_assert_stage_seconds_sum{stage=\"%s\",level=\"%s\"} %.9f\nppk_assert_stage_seconds_count{stage=\"%s\",level=\"%s\"} %lu\n",
+                    _stageNames[stage], labels, static_cast<double>(latency.total) / 1e9, _stageNames[stage], labels, latency.count);
+      }
+    }
+
+    writeFormat(writer, "# HELP ppk_assert_nested_failures_total Failed assertions fired while handling a failed assertion.\n"
+                        "# TYPE ppk_assert_nested_failures_total counter\nppk_assert_nested_failures_total %ld\n", atomicLoad(&_nestedFailures));
+
+    if (size)
+      buffer[writer.length < size ? writer.length : size - 1] = 0;
+
+    return writer.length;
+  }
+
+  bool PPK_ASSERT_CALL startMetricsExporter(const char* path, int port, int interval, int maxSites)
+  {
+#if !defined(_WIN32)
+    if (_metricsService.running || (!path && !port) || (path && strlen(path) >= sizeof(_metricsPath)) || interval <= 0)
+      return false;
+
+    int fd = -1;
+
+    if (port)
+    {
+      struct sockaddr_in address;
+      memset(&address, 0, sizeof(address));
+      address.sin_family = AF_INET;
+      address.sin_port = htons(static_cast<uint16_t>(port));
+      address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+      fd = socket(AF_INET, SOCK_STREAM, 0);
+
+      if (fd < 0)
+        return false;
+
+      int one = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+      if (bind(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, 16) != 0)
+      {
+        close(fd);
+        return false;
+      }
+    }
+
+    copyString(_metricsPath, sizeof(_metricsPath), path);
+    _metricsInterval = interval;
+    _metricsMaxSites = maxSites;
+    _metricsSocket = fd;
+
+    if (!startService(_metricsService, serveMetrics))
+    {
+      if (fd >= 0)
+        close(fd);
+
+      _metricsSocket = -1;
+      return false;
+    }
+
+    return true;
+#else
+    PPK_ASSERT_UNUSED(path);
+    PPK_ASSERT_UNUSED(port);
+    PPK_ASSERT_UNUSED(interval);
+    PPK_ASSERT_UNUSED(maxSites);
+    return false;
+#endif
+  }
+
+  void PPK_ASSERT_CALL stopMetricsExporter()
+  {
+#if !defined(_WIN32)
+    if (!_metricsService.running)
+      return;
+
+    stopService(_metricsService);
+
+    if (_metricsSocket >= 0)
+      close(_metricsSocket);
+
+    _metricsSocket = -1;
+#endif
+  }
+
+  bool PPK_ASSERT_CALL startStatsdEmitter(const char* host, int port, const char* prefix, int interval)
+  {
+#if !defined(_WIN32)
+    if (_statsdService.running || interval <= 0 || strlen(prefix) >= sizeof(_statsdPrefix))
+      return false;
+
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    struct addrinfo* addresses;
+
+    if (getaddrinfo(host, service, &hints, &addresses) != 0)
+      return false;
+
+    int fd = -1;
+
+    for (struct addrinfo* address = addresses; address && fd < 0; address = address->ai_next)
+    {
+      fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+      // connecting a UDP socket merely sets the default destination
+      if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) != 0)
+      {
+        close(fd);
+        fd = -1;
+      }
+    }
+
+    freeaddrinfo(addresses);
+
+    if (fd < 0)
+      return false;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    {
+      SpinLock lock(&_statsdLock);
+      copyString(_statsdPrefix, sizeof(_statsdPrefix), prefix);
+      _statsdInterval = interval;
+      _statsdSocket = fd;
+    }
+
+    if (!startService(_statsdService, serveStatsd))
+    {
+      SpinLock lock(&_statsdLock);
+      close(_statsdSocket);
+      _statsdSocket = -1;
+      return false;
+    }
+
+    return true;
+#else
+    PPK_ASSERT_UNUSED(host);
+    PPK_ASSERT_UNUSED(port);
+    PPK_ASSERT_UNUSED(prefix);
+    PPK_ASSERT_UNUSED(interval);
+    return false;
+#endif
+  }
+
+  void PPK_ASSERT_CALL flushStatsdEmitter()
+  {
+#if !defined(_WIN32)
+    flushStatsd();
+#endif
+  }
+
+  void PPK_ASSERT_CALL stopStatsdEmitter()
+  {
+#if !defined(_WIN32)
+    if (!_statsdService.running)
+      return;
+
+    stopService(_statsdService);
+
+    SpinLock lock(&_statsdLock);
+    close(_statsdSocket);
+    _statsdSocket = -1;
+#endif
+  }
+
+  bool PPK_ASSERT_CALL startEventShipper(const char* address, int interval)
+  {
+#if !defined(_WIN32)
+    if (_shipperService.running || interval <= 0 || strlen(address) >= sizeof(_shipperAddress))
+      return false;
+
+    initializeQueue(_shipperQueue);
+    copyString(_shipperAddress, sizeof(_shipperAddress), address);
+    _shipperInterval = interval;
+
+    if (!startService(_shipperService, serveShipper))
+      return false;
+
+    atomicStore(&_shipperEnabled, 1);
+    return true;
+#else
+    PPK_ASSERT_UNUSED(address);
+    PPK_ASSERT_UNUSED(interval);
+    return false;
+#endif
+  }
+
+  void PPK_ASSERT_CALL stopEventShipper()
+  {
+#if !defined(_WIN32)
+    atomicStore(&_shipperEnabled, 0);
+    stopService(_shipperService);
+#endif
+  }
+
+  unsigned long PPK_ASSERT_CALL droppedShippedEvents()
+  {
+#if !defined(_WIN32)
+    return static_cast<unsigned long>(atomicLoad(&_shipperQueue.dropped));
+#else
+    return 0;
+#endif
+  }
+
+  bool PPK_ASSERT_CALL setDispatchPolicy(int level, AssertAction::AssertAction action)
+  {
+    if (action != AssertAction::None && action != AssertAction::Throw && action != AssertAction::Abort)
+      return false;
+
+    SpinLock lock(&_dispatchPolicyLock);
+    long count = atomicLoad(&_dispatchPolicyCount);
+
+    for (long i = 0; i < count; ++i)
+    {
+      if (_dispatchPolicyLevels[i] == level)
       {
-        memcpy(_heap, message, sizeof(char) * length); // copy the message
-        _heap[length] = 0;
-        _stack[size - 1] = 1; // mark the stack
+        atomicStore(&_dispatchPolicyActions[i], action);
+        return true;
       }
     }
+
+    if (count == PPK_ASSERT_DISPATCH_POLICIES)
+      return false;
+
+    _dispatchPolicyLevels[count] = level;
+    atomicStore(&_dispatchPolicyActions[count], action);
+    atomicStore(&_dispatchPolicyCount, count + 1);
+
+    return true;
   }
 
-  AssertionException::~AssertionException() PPK_ASSERT_EXCEPTION_NO_THROW
+  bool PPK_ASSERT_CALL startAsyncDispatch()
   {
-    if (_stack[size - 1])
-      PPK_ASSERT_FREE(_heap);
+#if !defined(_WIN32)
+    if (_dispatchService.running)
+      return false;
 
-    _heap = PPK_ASSERT_NULLPTR; // in case the exception object is destroyed twice
-    _stack[size - 1] = 0;
+    // never closed, failing threads may write to it after stopAsyncDispatch()
+    if (_dispatchWakeup[0] < 0)
+    {
+      if (pipe(_dispatchWakeup) != 0)
+        return false;
+
+      for (int i = 0; i < 2; ++i)
+      {
+        fcntl(_dispatchWakeup[i], F_SETFL, fcntl(_dispatchWakeup[i], F_GETFL) | O_NONBLOCK);
+        fcntl(_dispatchWakeup[i], F_SETFD, FD_CLOEXEC);
+      }
+    }
+
+    initializeQueue(_dispatchQueue);
+
+    if (!startService(_dispatchService, serveDispatch))
+      return false;
+
+    atomicStore(&_dispatchEnabled, 1);
+    return true;
+#else
+    return false;
+#endif
   }
 
-  AssertionException& AssertionException::operator = (const AssertionException& rhs)
+  void PPK_ASSERT_CALL stopAsyncDispatch()
   {
-    if (&rhs == this)
-      return *this;
+#if !defined(_WIN32)
+    // the worker drains the queue before stopping
+    atomicStore(&_dispatchEnabled, 0);
+    stopService(_dispatchService);
+#endif
+  }
 
-    const char* message = rhs.what();
-    size_t length = strlen(message);
+  unsigned long PPK_ASSERT_CALL droppedDispatchedEvents()
+  {
+#if !defined(_WIN32)
+    return static_cast<unsigned long>(atomicLoad(&_dispatchQueue.dropped));
+#else
+    return 0;
+#endif
+  }
 
-    if (length < size) // message is short enough for the stack buffer
-    {
-      if (_stack[size - 1])
-        PPK_ASSERT_FREE(_heap);
+  DispatchLatency PPK_ASSERT_CALL dispatchLatency()
+  {
+    DispatchLatency latency;
+    latency.count = 0;
 
-      memcpy(_stack, message, sizeof(char) * size);
+    for (int i = 0; i < PPK_ASSERT_DISPATCH_LATENCY_BUCKETS; ++i)
+    {
+      latency.buckets[i] = static_cast<unsigned long>(atomicLoad(&_dispatchBuckets[i]));
+      latency.count += latency.buckets[i];
     }
-    else // allocate storage on the heap
+
+    latency.total = atomicLoad64(&_dispatchTime);
+    latency.max = atomicLoad64(&_dispatchMaxTime);
+
+    return latency;
+  }
+
+  StageLatency PPK_ASSERT_CALL stageLatency(int stage, int level)
+  {
+    StageLatency latency;
+    memset(&latency, 0, sizeof(latency));
+
+    if (stage < 0 || stage >= AssertStage::Count)
+      return latency;
+
+    level = latencyLevel(level);
+
+    for (int i = 0; i < PPK_ASSERT_LATENCY_BUCKETS; ++i)
     {
-      if (_stack[size - 1])
-      {
-        size_t _length = strlen(_heap);
+      latency.buckets[i] = static_cast<unsigned long>(atomicLoad(&_stageBuckets[level][stage][i]));
+      latency.count += latency.buckets[i];
+    }
 
-        if (length <= _length)
-        {
-          memcpy(_heap, message, sizeof(char) * _length); // copy the message, pad with 0
-          return *this;
-        }
-        else
-        {
-          PPK_ASSERT_FREE(_heap);
-        }
-      }
+    latency.total = atomicLoad64(&_stageTime[level][stage]);
+    latency.max = atomicLoad64(&_stageMaxTime[level][stage]);
 
-      _heap = static_cast<char*>(PPK_ASSERT_MALLOC(sizeof(char) * (length + 1)));
+    return latency;
+  }
 
-      if (!_heap) // allocation failed
+  int64_t PPK_ASSERT_CALL latencyBucketBound(int bucket)
+  {
+    if (bucket < 4)
+      return bucket < 0 ? 0 : bucket;
+
+    return static_cast<int64_t>(4 + bucket % 4) << (bucket / 4 - 1);
+  }
+
+  int64_t PPK_ASSERT_CALL latencyPercentile(const StageLatency& latency, double percentile)
+  {
+    double rank = static_cast<double>(latency.count) * percentile / 100;
+    unsigned long count = 0;
+
+    for (int i = 0; i < PPK_ASSERT_LATENCY_BUCKETS - 1; ++i)
+    {
+      count += latency.buckets[i];
+
+      if (count && static_cast<double>(count) >= rank)
       {
-        memcpy(_stack, message, sizeof(char) * (size - 1)); // stack fallback, truncate :/
-        _stack[size - 1] = 0;
+        int64_t bound = latencyBucketBound(i + 1) - 1;
+        return bound < latency.max ? bound : latency.max;
       }
-      else
+    }
+
+    return latency.max;
+  }
+
+  void PPK_ASSERT_CALL dumpStageLatency(int fd)
+  {
+#if !defined(_WIN32)
+    SignalWriter writer;
+    writer.fd = fd;
+    writer.length = 0;
+
+    for (int level = 0; level < PPK_ASSERT_LATENCY_LEVELS; ++level)
+    {
+      for (int stage = 0; stage < AssertStage::Count; ++stage)
       {
-        memcpy(_heap, message, sizeof(char) * length); // copy the message
-        _heap[length] = 0;
-        _stack[size - 1] = 1; // mark the stack
+        StageLatency latency = stageLatency(stage, _latencyLevels[level]);
+
+        if (!latency.count)
+          continue;
+
+        writeSignalString(writer, levelString(_latencyLevels[level]));
+        writeSignalString(writer, " ");
+        writeSignalString(writer, _stageNames[stage]);
+        writeSignalString(writer, " count ");
+        writeSignalNumber(writer, static_cast<int64_t>(latency.count), 0);
+        writeSignalString(writer, " mean-ns ");
+        writeSignalNumber(writer, latency.total / static_cast<int64_t>(latency.count), 0);
+        writeSignalString(writer, " p50-ns ");
+        writeSignalNumber(writer, latencyPercentile(latency, 50), 0);
+        writeSignalString(writer, " p99-ns ");
+        writeSignalNumber(writer, latencyPercentile(latency, 99), 0);
+        writeSignalString(writer, " max-ns ");
+        writeSignalNumber(writer, latency.max, 0);
+        writeSignalString(writer, "\n");
       }
     }
 
-    _file = rhs._file;
-    _line = rhs._line;
-    _function = rhs._function;
-    _expression = rhs._expression;
-
-    return *this;
+    flushSignalWriter(writer);
+#else
+    PPK_ASSERT_UNUSED(fd);
+#endif
   }
 
-  const char* AssertionException::what() const PPK_ASSERT_EXCEPTION_NO_THROW
+  extern "C" const Journal ppk_assert_journal =
   {
-    return _stack[size - 1] ? _heap : _stack;
-  }
+    {'P', 'P', 'K', 'J', 'R', 'N', 'L', '1'},
+    PPK_ASSERT_JOURNAL_VERSION,
+    sizeof(void*),
+    sizeof(long),
+    PPK_ASSERT_FLIGHT_RECORDER_SIZE,
+    sizeof(FlightRecord),
+    offsetof(FlightRecord, sequence),
+    offsetof(FlightRecord, event),
+    PPK_ASSERT_SITE_TABLE_SIZE,
+    sizeof(Site),
+    offsetof(Site, ready),
+    offsetof(Site, file),
+    offsetof(Site, line),
+    offsetof(Site, expression),
+    offsetof(Site, level),
+    offsetof(Site, failures),
+    0,
+    _flightRecorder,
+    &_flightRecorderHead,
+    _sites
+  };
 
-namespace implementation {
+  void PPK_ASSERT_CALL dumpFlightRecorder(int fd)
+  {
+#if !defined(_WIN32)
+    SignalWriter writer;
+    writer.fd = fd;
+    writer.length = 0;
 
-  namespace {
-    bool _ignoreAll = false;
+    long head = atomicLoad(&_flightRecorderHead);
+
+    for (long position = head > PPK_ASSERT_FLIGHT_RECORDER_SIZE ? head - PPK_ASSERT_FLIGHT_RECORDER_SIZE : 0; position < head; ++position)
+    {
+      const FlightRecord& record = _flightRecorder[position & (PPK_ASSERT_FLIGHT_RECORDER_SIZE - 1)];
+
+      if (atomicLoad(&record.sequence) != position + 1)
+        continue;
+
+      EventRecord event = record.event;
+
+      if (atomicLoad(&record.sequence) != position + 1)
+        continue;
+
+      event.file[sizeof(event.file) - 1] = 0;
+      event.function[sizeof(event.function) - 1] = 0;
+      event.expression[sizeof(event.expression) - 1] = 0;
+      event.message[sizeof(event.message) - 1] = 0;
+
+      writeSignalEvent(writer, event);
+    }
+
+    flushSignalWriter(writer);
+#else
+    PPK_ASSERT_UNUSED(fd);
+#endif
   }
 
-  void PPK_ASSERT_CALL ignoreAllAsserts(bool value)
+  bool PPK_ASSERT_CALL installCrashHandler(const char* path)
   {
-    _ignoreAll = value;
+#if !defined(_WIN32)
+    if (path && strlen(path) >= sizeof(_crashPath))
+      return false;
+
+    copyString(_crashPath, sizeof(_crashPath), path);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = crashHandler;
+    action.sa_flags = SA_RESETHAND | SA_ONSTACK; // a crash while dumping kills the process
+    sigemptyset(&action.sa_mask);
+
+    for (size_t i = 0; i < sizeof(_crashSignals) / sizeof(_crashSignals[0]); ++i)
+    {
+      struct sigaction previous;
+      if (sigaction(_crashSignals[i], &action, &previous) != 0)
+        return false;
+
+      // when installed again, keep chaining to the handler found the first
+      // time instead of to crashHandler itself
+      if ((previous.sa_flags & SA_SIGINFO) || previous.sa_handler != crashHandler)
+        _crashPrevious[i] = previous;
+    }
+
+    return true;
+#else
+    PPK_ASSERT_UNUSED(path);
+    return false;
+#endif
   }
 
-  bool PPK_ASSERT_CALL ignoreAllAsserts()
+  const StackTrace* PPK_ASSERT_CALL currentStackTrace()
   {
-    return _ignoreAll;
+    return _currentStack;
   }
 
-  namespace {
-    AssertHandler _handler = _defaultHandler;
+  const EventRecord* PPK_ASSERT_CALL currentEvent()
+  {
+    return _currentEvent;
   }
 
-  AssertHandler PPK_ASSERT_CALL setAssertHandler(AssertHandler handler)
+  const char* PPK_ASSERT_CALL symbolize(const void* pc)
   {
-    AssertHandler previous = _handler;
+    unsigned long hash = static_cast<unsigned long>(reinterpret_cast<uintptr_t>(pc) >> 2);
+    hash ^= hash >> 16;
+
+    {
+      SpinLock lock(&_symbolsLock);
+
+      for (unsigned long i = 0; i < PPK_ASSERT_SYMBOL_CACHE_SIZE; ++i)
+      {
+        SymbolEntry& entry = _symbols[(hash + i) & (PPK_ASSERT_SYMBOL_CACHE_SIZE - 1)];
 
-    _handler = handler ? handler : _defaultHandler;
+        if (entry.pc == pc)
+          return entry.symbol;
 
-    return previous;
+        if (!entry.pc)
+          break;
+      }
+    }
+
+    // symbolizing allocates and takes locks, it's done outside of the spin lock
+    char symbol[512];
+    describeAddress(pc, symbol, sizeof(symbol));
+    size_t length = strlen(symbol) + 1;
+
+    SpinLock lock(&_symbolsLock);
+
+    for (unsigned long i = 0; i < PPK_ASSERT_SYMBOL_CACHE_SIZE; ++i)
+    {
+      SymbolEntry& entry = _symbols[(hash + i) & (PPK_ASSERT_SYMBOL_CACHE_SIZE - 1)];
+
+      if (entry.pc == pc)
+        return entry.symbol; // symbolized concurrently
+
+      if (entry.pc)
+        continue;
+
+      if (_symbolArenaLength + length > sizeof(_symbolArena))
+        break;
+
+      entry.symbol = _symbolArena + _symbolArenaLength;
+      memcpy(_symbolArena + _symbolArenaLength, symbol, length);
+      _symbolArenaLength += length;
+      entry.pc = pc;
+
+      return entry.symbol;
+    }
+
+    return "??"; // the cache is full
   }
 
   AssertAction::AssertAction PPK_ASSERT_CALL handleAssert(const char* file,
@@ -440,26 +4719,171 @@ namespace implementation {
                                                           const char* message, ...)
   {
     char message_[PPK_ASSERT_MESSAGE_BUFFER_SIZE] = {0};
-    const char* file_;
+
+    file = baseName(file);
+
+    if (_assertDepth > 0)
+    {
+      if (level >= atomicLoad(&_levelThreshold))
+      {
+        atomicAdd(&_nestedFailures, 1);
+        reportNested(file, line, expression);
+      }
+
+      return AssertAction::None;
+    }
+
+    ReentrancyGuard guard; // released when returning or throwing
+    StageTimer timer(level);
+
+#if !defined(_WIN32)
+    // sites are only looked up, registering one takes a lock
+    const bool signalSafe = _signalSafe;
+    Site* site = signalSafe ? findSite(hashSite(file, line, expression), file, line, expression) : acquireSite(file, line, function, expression, level, ignoreLine);
+#else
+    const bool signalSafe = false;
+    PPK_ASSERT_UNUSED(signalSafe);
+    Site* site = acquireSite(file, line, function, expression, level, ignoreLine);
+#endif
+
+    if ((site && atomicLoad(&site->muted)) || level < atomicLoad(&_levelThreshold))
+    {
+      if (site)
+        atomicAdd(&site->suppressed, 1);
+
+      timer.discard();
+      return AssertAction::None;
+    }
+
+    timer.lap(AssertStage::Lookup);
+
+#if !defined(_WIN32)
+    // thread handlers are called synchronously, they may depend on the
+    // failing thread's state or on the scope that installed them
+    const bool dispatched = !signalSafe && level < AssertLevel::Fatal && !_threadHandler && atomicLoad(&_dispatchEnabled);
+#else
+    const bool dispatched = false;
+#endif
+    // decided upfront, the stack is only needed by AssertionException
+    const AssertAction::AssertAction policy = dispatched ? dispatchPolicy(level) : AssertAction::None;
 
     if (message)
     {
       va_list args;
       va_start(args, message);
-      vsnprintf(message_, PPK_ASSERT_MESSAGE_BUFFER_SIZE, message, args);
+#if !defined(_WIN32)
+      if (signalSafe)
+        formatSignalSafe(message_, PPK_ASSERT_MESSAGE_BUFFER_SIZE, message, args);
+      else
+#endif
+        vsnprintf(message_, PPK_ASSERT_MESSAGE_BUFFER_SIZE, message, args);
       va_end(args);
 
       message = message_;
     }
 
-#if defined(_WIN32)
-    file_ = strrchr(file, '\\');
-#else
-    file_ = strrchr(file, '/');
-#endif // #if defined(_WIN32)
+    if (!signalSafe) // formatting breadcrumbs isn't async-signal-safe
+      message = appendBreadcrumbs(message_, PPK_ASSERT_MESSAGE_BUFFER_SIZE, message);
+
+    timer.lap(AssertStage::Format);
+
+    if (site)
+    {
+      atomicAdd(&site->failures, 1);
+#if defined(PPK_ASSERT_HEAVY_HITTERS)
+      if (!signalSafe)
+        recordHeavyHitter(*site, message);
+#endif
+    }
 
-    file = file_ ? file_ + 1 : file;
-    AssertAction::AssertAction action = _handler(file, line, function, expression, level, message);
+#if !defined(_WIN32)
+    if (StatsHeader* stats = __atomic_load_n(&_statsFile, __ATOMIC_ACQUIRE))
+      recordStats(stats, file, line, expression, level);
+
+    if (StatsHeader* stats = __atomic_load_n(&_statsSegment, __ATOMIC_ACQUIRE))
+      recordStats(stats, file, line, expression, level);
+#endif
+
+    EventRecord event;
+    fillEventRecord(event, file, line, function, expression, level, message);
+    recordFlight(event);
+    timer.lap(AssertStage::Record);
+
+#if defined(PPK_ASSERT_HAVE_SHM)
+    EventsHeader* events = __atomic_load_n(&_eventSegment, __ATOMIC_ACQUIRE);
+
+    if (events && !signalSafe) // claiming a ring isn't async-signal-safe
+      publishEvent(events, event);
+#endif
+
+#if !defined(_WIN32)
+    if (atomicLoad(&_shipperEnabled))
+      enqueue(_shipperQueue, event);
+#endif
+
+    timer.lap(AssertStage::Publish);
+
+#if !defined(_WIN32)
+    if (signalSafe)
+    {
+      AssertAction::AssertAction action = reportSignalSafe(event);
+      timer.lap(AssertStage::Handler);
+
+      if (action == AssertAction::Abort)
+        PPK_ASSERT_ABORT();
+
+      return action;
+    }
+#endif
+
+    StackTrace stack;
+    stack.depth = 0;
+#if PPK_ASSERT_STACK_DEPTH > 0
+    if (!dispatched || policy == AssertAction::Throw)
+      captureStack(stack);
+#endif
+    timer.lap(AssertStage::Stack);
+
+    AssertHandler handler = _threadHandler ? _threadHandler : atomicLoadPointer(&_handler);
+    AssertAction::AssertAction action;
+
+    if (dispatched)
+    {
+      action = policy;
+#if !defined(_WIN32)
+      dispatchEvent(event, handler, ignoreLine);
+#endif
+      timer.lap(AssertStage::Dispatch);
+      recordDispatchLatency(timer.elapsed() / 1000); // since handleAssert() was entered
+    }
+    else
+    {
+      const StackTrace* previousStack = _currentStack; // in case the handler fires assertions
+      const EventRecord* previousEvent = _currentEvent;
+      _currentStack = &stack;
+      _currentEvent = &event;
+      notifySubscribers(event);
+      timer.lap(AssertStage::Subscribers);
+
+      int64_t start = monotonicTime();
+      action = handler(file, line, function, expression, level, message);
+      recordHandlerTime(monotonicTime() - start);
+      timer.lap(AssertStage::Handler);
+      _currentStack = previousStack;
+      _currentEvent = previousEvent;
+    }
+
+    if (site)
+    {
+      if (action == AssertAction::Ignore || action == AssertAction::IgnoreAll
+#if !defined(PPK_ASSERT_DISABLE_IGNORE_LINE)
+       || action == AssertAction::IgnoreLine
+#endif
+         )
+        atomicAdd(&site->ignored, 1);
+      else if (action == AssertAction::Throw)
+        atomicAdd(&site->thrown, 1);
+    }
 
     switch (action)
     {
@@ -468,7 +4892,7 @@ namespace implementation {
 
 #if !defined(PPK_ASSERT_DISABLE_IGNORE_LINE)
       case AssertAction::IgnoreLine:
-        *ignoreLine = true;
+        storeLineIgnored(ignoreLine, true);
         break;
 #else
       PPK_ASSERT_UNUSED(ignoreLine);
@@ -479,7 +4903,8 @@ namespace implementation {
         break;
 
       case AssertAction::Throw:
-        _throw(file, line, function, expression, message);
+        timer.open(AssertStage::Throw);
+        _throw(file, line, function, expression, message, stack);
         break;
 
       case AssertAction::Ignore:
@@ -36,6 +36,8 @@
       return true;
     }
 
+    PPK_ASSERT_CONTEXT(format, ...);
+
   compile-time assertions:
 
     PPK_STATIC_ASSERT(expression)
@@ -177,7 +179,7 @@
         __pragma(warning(disable: 4127))\
         do\
         {\
-          if (PPK_ASSERT_LIKELY(expression) || ppk::assert::implementation::ignoreAllAsserts());\
+          if (PPK_ASSERT_LIKELY(expression) || ppk::assert::implementation::suppressed(level) || ppk::assert::implementation::ignoreAllAsserts());\
           else\
           {\
             if (ppk::assert::implementation::handleAssert(PPK_ASSERT_FILE, PPK_ASSERT_LINE, PPK_ASSERT_FUNCTION, #expression, level, PPK_ASSERT_NULLPTR, __VA_ARGS__) == ppk::assert::implementation::AssertAction::Break)\
@@ -195,7 +197,7 @@
         do\
         {\
           static bool _ignore = false;\
-          if (PPK_ASSERT_LIKELY(expression) || _ignore || ppk::assert::implementation::ignoreAllAsserts());\
+          if (PPK_ASSERT_LIKELY(expression) || ppk::assert::implementation::lineIgnored(&_ignore) || ppk::assert::implementation::suppressed(level) || ppk::assert::implementation::ignoreAllAsserts());\
           else\
           {\
             if (ppk::assert::implementation::handleAssert(PPK_ASSERT_FILE, PPK_ASSERT_LINE, PPK_ASSERT_FUNCTION, #expression, level, &_ignore, __VA_ARGS__) == ppk::assert::implementation::AssertAction::Break)\
@@ -226,7 +228,7 @@
       #define PPK_ASSERT_3(level, expression, ...)\
         do\
         {\
-          if (PPK_ASSERT_LIKELY(expression) || ppk::assert::implementation::ignoreAllAsserts());\
+          if (PPK_ASSERT_LIKELY(expression) || ppk::assert::implementation::suppressed(level) || ppk::assert::implementation::ignoreAllAsserts());\
           else\
           {\
             _PPK_ASSERT_WFORMAT_AS_ERROR_BEGIN\
@@ -243,7 +245,7 @@
         do\
         {\
           static bool _ignore = false;\
-          if (PPK_ASSERT_LIKELY(expression) || _ignore || ppk::assert::implementation::ignoreAllAsserts());\
+          if (PPK_ASSERT_LIKELY(expression) || ppk::assert::implementation::lineIgnored(&_ignore) || ppk::assert::implementation::suppressed(level) || ppk::assert::implementation::ignoreAllAsserts());\
           else\
           {\
             _PPK_ASSERT_WFORMAT_AS_ERROR_BEGIN\
@@ -317,6 +319,10 @@
     #define PPK_ASSERT_EXCEPTION_MESSAGE_BUFFER_SIZE 1024
   #endif
 
+  #if !defined(PPK_ASSERT_EXCEPTION_STACK_DEPTH)
+    #define PPK_ASSERT_EXCEPTION_STACK_DEPTH 16
+  #endif
+
   #if defined(PPK_ASSERT_CXX11) && !defined(_MSC_VER)
     #define PPK_ASSERT_EXCEPTION_NO_THROW noexcept(true)
   #else
@@ -327,6 +333,18 @@
     #include <utility>
   #endif
 
+  #include <assert.h>
+  #include <limits.h>
+  #include <stdint.h>
+
+  #if !defined(PPK_ASSERT_THREAD_LOCAL)
+    #if defined(_MSC_VER)
+      #define PPK_ASSERT_THREAD_LOCAL __declspec(thread)
+    #else
+      #define PPK_ASSERT_THREAD_LOCAL __thread
+    #endif
+  #endif
+
   namespace ppk {
   namespace assert {
 
@@ -343,6 +361,16 @@
                                   const char* expression,
                                   const char* message);
 
+      // keeps up to PPK_ASSERT_EXCEPTION_STACK_DEPTH return addresses,
+      // innermost first
+      AssertionException(const char* file,
+                         int line,
+                         const char* function,
+                         const char* expression,
+                         const char* message,
+                         void* const* frames,
+                         int depth);
+
       AssertionException(const AssertionException& rhs);
 
       virtual ~AssertionException() PPK_ASSERT_EXCEPTION_NO_THROW;
@@ -356,11 +384,25 @@
       const char* function() const;
       const char* expression() const;
 
+      // raw stack captured when the exception was thrown, innermost first
+      int stackDepth() const;
+      void* stackFrame(int i) const;
+
+      // symbolized stack, one frame per line, formatted on first call, not
+      // thread safe
+      const char* stackTrace() const;
+
       private:
+      void setMessage(const char* message);
+      void setStack(void* const* frames, int depth);
+
       const char* _file;
       int _line;
       const char* _function;
       const char* _expression;
+      int _depth;
+      void* _frames[PPK_ASSERT_EXCEPTION_STACK_DEPTH > 0 ? PPK_ASSERT_EXCEPTION_STACK_DEPTH : 1];
+      mutable char* _stackTrace;
 
       enum
       {
@@ -397,6 +439,16 @@
       return _expression;
     }
 
+    PPK_ASSERT_ALWAYS_INLINE int AssertionException::stackDepth() const
+    {
+      return _depth;
+    }
+
+    PPK_ASSERT_ALWAYS_INLINE void* AssertionException::stackFrame(int i) const
+    {
+      return _frames[i];
+    }
+
     namespace implementation {
 
     #if defined(_MSC_VER) && !defined(_CPPUNWIND)
@@ -469,6 +521,10 @@
     #define PPK_ASSERT_HANDLE_ASSERT_FORMAT
   #endif
 
+  #if defined(_MSC_VER) && defined(PPK_ASSERT_FUNCSPEC)
+    #define PPK_ASSERT_THREAD_LOCAL_CALLS // thread local variables can't be imported from a DLL
+  #endif
+
   #if !defined(PPK_ASSERT_FUNCSPEC)
     #define PPK_ASSERT_FUNCSPEC
   #endif
@@ -485,12 +541,753 @@
     PPK_ASSERT_FUNCSPEC
     AssertHandler PPK_ASSERT_CALL setAssertHandler(AssertHandler handler);
 
+    // installs a handler for the calling thread only, it takes precedence over
+    // the one installed by setAssertHandler(), null falls back to it. Returns
+    // the previous one, see HandlerScope
+    PPK_ASSERT_FUNCSPEC
+    AssertHandler PPK_ASSERT_CALL setThreadAssertHandler(AssertHandler handler);
+
+    // installs a handler for the calling thread for the lifetime of the scope,
+    // scopes nest
+    class HandlerScope
+    {
+      public:
+      explicit HandlerScope(AssertHandler handler)
+      : _previous(setThreadAssertHandler(handler))
+      {}
+
+      ~HandlerScope()
+      {
+        setThreadAssertHandler(_previous);
+      }
+
+      private:
+      HandlerScope(const HandlerScope&);
+      HandlerScope& operator = (const HandlerScope&);
+
+      AssertHandler _previous;
+    }; // HandlerScope
+
     PPK_ASSERT_FUNCSPEC
     void PPK_ASSERT_CALL ignoreAllAsserts(bool value);
 
     PPK_ASSERT_FUNCSPEC
     bool PPK_ASSERT_CALL ignoreAllAsserts();
 
+    // failed assertions with a level lower than the calling thread's suppress
+    // level are ignored, sets it and returns the previous one, see
+    // SuppressScope
+    PPK_ASSERT_FUNCSPEC
+    int PPK_ASSERT_CALL setSuppressLevel(int level);
+
+    PPK_ASSERT_FUNCSPEC
+    int PPK_ASSERT_CALL suppressLevel();
+
+  #if !defined(PPK_ASSERT_THREAD_LOCAL_CALLS)
+    extern PPK_ASSERT_THREAD_LOCAL int _suppressLevel;
+
+    // a single thread local load, tested inline by failed assertions
+    PPK_ASSERT_ALWAYS_INLINE bool suppressed(int level)
+    {
+      return level < _suppressLevel;
+    }
+  #else
+    inline bool suppressed(int level)
+    {
+      return level < suppressLevel();
+    }
+  #endif
+
+    // the flag of an assertion answered with IgnoreLine, also written by other
+    // threads, e.g. by the admin server muting its site
+    PPK_ASSERT_ALWAYS_INLINE bool lineIgnored(const bool* ignoreLine)
+    {
+  #if defined(__GNUC__)
+      return __atomic_load_n(ignoreLine, __ATOMIC_RELAXED);
+  #else
+      return *static_cast<const volatile bool*>(ignoreLine);
+  #endif
+    }
+
+    // ignores the calling thread's failed assertions with a level lower than
+    // level, all but FATAL ones by default, for the lifetime of the scope.
+    // Pass INT_MAX to also ignore FATAL failures. Nested scopes never lower the
+    // level of enclosing ones
+    class SuppressScope
+    {
+      public:
+      explicit SuppressScope(int level = AssertLevel::Fatal)
+      : _previous(setSuppressLevel(level > suppressLevel() ? level : suppressLevel()))
+      {}
+
+      ~SuppressScope()
+      {
+        setSuppressLevel(_previous);
+      }
+
+      private:
+      SuppressScope(const SuppressScope&);
+      SuppressScope& operator = (const SuppressScope&);
+
+      int _previous;
+    }; // SuppressScope
+
+  #define PPK_ASSERT_CORRELATION_WORDS 4
+
+    // application defined words copied into EventRecord::correlation by the
+    // calling thread's failed assertions, e.g. the ids of the request and of
+    // the trace being served
+  #if !defined(PPK_ASSERT_THREAD_LOCAL_CALLS)
+    extern PPK_ASSERT_THREAD_LOCAL uint64_t _correlation[PPK_ASSERT_CORRELATION_WORDS];
+
+    // a plain thread local store, index is only checked in debug builds
+    PPK_ASSERT_ALWAYS_INLINE void setCorrelation(int index, uint64_t value)
+    {
+      assert(index >= 0 && index < PPK_ASSERT_CORRELATION_WORDS);
+      _correlation[index] = value;
+    }
+
+    PPK_ASSERT_ALWAYS_INLINE uint64_t correlation(int index)
+    {
+      assert(index >= 0 && index < PPK_ASSERT_CORRELATION_WORDS);
+      return _correlation[index];
+    }
+  #else
+    PPK_ASSERT_FUNCSPEC
+    void PPK_ASSERT_CALL setCorrelation(int index, uint64_t value);
+
+    PPK_ASSERT_FUNCSPEC
+    uint64_t PPK_ASSERT_CALL correlation(int index);
+  #endif
+
+    // sets a correlation word for the lifetime of the scope
+    class CorrelationScope
+    {
+      public:
+      CorrelationScope(int index, uint64_t value)
+      : _index(index)
+      , _previous(correlation(index))
+      {
+        setCorrelation(index, value);
+      }
+
+      ~CorrelationScope()
+      {
+        setCorrelation(_index, _previous);
+      }
+
+      private:
+      CorrelationScope(const CorrelationScope&);
+      CorrelationScope& operator = (const CorrelationScope&);
+
+      int _index;
+      uint64_t _previous;
+    }; // CorrelationScope
+
+    // an argument of PPK_ASSERT_CONTEXT(), captured as is and only formatted
+    // when an assertion fails
+    // long long isn't C++03, but int64_t is a long long on some platforms
+  #if defined(__GNUC__)
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wlong-long"
+  #endif
+    typedef long long LongLong;
+    typedef unsigned long long UnsignedLongLong;
+  #if defined(__GNUC__)
+    #pragma GCC diagnostic pop
+  #endif
+
+    struct BreadcrumbArgument
+    {
+      enum Type
+      {
+        Signed,
+        Unsigned,
+        Floating,
+        String,
+        Pointer
+      }; // Type
+
+      BreadcrumbArgument() {}
+      BreadcrumbArgument(int i) : type(Signed) { value.i = i; }
+      BreadcrumbArgument(long i) : type(Signed) { value.i = i; }
+      BreadcrumbArgument(unsigned u) : type(Unsigned) { value.u = u; }
+      BreadcrumbArgument(unsigned long u) : type(Unsigned) { value.u = u; }
+      BreadcrumbArgument(LongLong i) : type(Signed) { value.i = i; }
+      BreadcrumbArgument(UnsignedLongLong u) : type(Unsigned) { value.u = u; }
+      BreadcrumbArgument(double d) : type(Floating) { value.d = d; }
+      BreadcrumbArgument(const char* s) : type(String) { value.s = s; }
+      BreadcrumbArgument(const void* p) : type(Pointer) { value.p = p; }
+
+      int type;
+      union
+      {
+        int64_t i;
+        uint64_t u;
+        double d;
+        const char* s;
+        const void* p;
+      } value;
+    }; // BreadcrumbArgument
+
+    class Breadcrumb;
+
+  #if !defined(PPK_ASSERT_THREAD_LOCAL_CALLS)
+    extern PPK_ASSERT_THREAD_LOCAL const Breadcrumb* _breadcrumbs;
+
+    // installs the calling thread's innermost breadcrumb, returns the
+    // previous one
+    PPK_ASSERT_ALWAYS_INLINE const Breadcrumb* setBreadcrumbs(const Breadcrumb* breadcrumbs)
+    {
+      const Breadcrumb* previous = _breadcrumbs;
+      _breadcrumbs = breadcrumbs;
+
+      return previous;
+    }
+
+    PPK_ASSERT_ALWAYS_INLINE const Breadcrumb* breadcrumbs()
+    {
+      return _breadcrumbs;
+    }
+  #else
+    PPK_ASSERT_FUNCSPEC
+    const Breadcrumb* PPK_ASSERT_CALL setBreadcrumbs(const Breadcrumb* breadcrumbs);
+
+    PPK_ASSERT_FUNCSPEC
+    const Breadcrumb* PPK_ASSERT_CALL breadcrumbs();
+  #endif
+
+    // describes what the calling thread is doing for the lifetime of the
+    // scope, see PPK_ASSERT_CONTEXT(). Breadcrumbs are linked from the
+    // innermost to the outermost, the format and the strings passed as
+    // arguments must outlive the scope
+    class Breadcrumb
+    {
+      public:
+      explicit Breadcrumb(const char* format)
+      : _format(format)
+      , _count(0)
+      {
+        _previous = setBreadcrumbs(this);
+      }
+
+      template <typename A>
+      Breadcrumb(const char* format, const A& a)
+      : _format(format)
+      , _count(1)
+      {
+        _arguments[0] = BreadcrumbArgument(a);
+        _previous = setBreadcrumbs(this);
+      }
+
+      template <typename A, typename B>
+      Breadcrumb(const char* format, const A& a, const B& b)
+      : _format(format)
+      , _count(2)
+      {
+        _arguments[0] = BreadcrumbArgument(a);
+        _arguments[1] = BreadcrumbArgument(b);
+        _previous = setBreadcrumbs(this);
+      }
+
+      template <typename A, typename B, typename C>
+      Breadcrumb(const char* format, const A& a, const B& b, const C& c)
+      : _format(format)
+      , _count(3)
+      {
+        _arguments[0] = BreadcrumbArgument(a);
+        _arguments[1] = BreadcrumbArgument(b);
+        _arguments[2] = BreadcrumbArgument(c);
+        _previous = setBreadcrumbs(this);
+      }
+
+      template <typename A, typename B, typename C, typename D>
+      Breadcrumb(const char* format, const A& a, const B& b, const C& c, const D& d)
+      : _format(format)
+      , _count(4)
+      {
+        _arguments[0] = BreadcrumbArgument(a);
+        _arguments[1] = BreadcrumbArgument(b);
+        _arguments[2] = BreadcrumbArgument(c);
+        _arguments[3] = BreadcrumbArgument(d);
+        _previous = setBreadcrumbs(this);
+      }
+
+      ~Breadcrumb()
+      {
+        setBreadcrumbs(_previous);
+      }
+
+      const char* format() const { return _format; }
+      int argumentCount() const { return _count; }
+      const BreadcrumbArgument& argument(int index) const { return _arguments[index]; }
+      const Breadcrumb* previous() const { return _previous; }
+
+      private:
+      Breadcrumb(const Breadcrumb&);
+      Breadcrumb& operator = (const Breadcrumb&);
+
+      const char* _format;
+      int _count;
+      BreadcrumbArgument _arguments[4];
+      const Breadcrumb* _previous;
+    }; // Breadcrumb
+
+    // the assertion context of a logical task, e.g. a coroutine hopping across
+    // the threads of a pool: its id, its correlation words and its
+    // breadcrumbs. Keep one in the coroutine promise or the executor task and
+    // install it with an AssertContextScope each time the task runs
+    struct AssertContext
+    {
+      explicit AssertContext(uint64_t id = 0)
+      : taskId(id)
+      , breadcrumbs(PPK_ASSERT_NULLPTR)
+      {
+        for (int i = 0; i < PPK_ASSERT_CORRELATION_WORDS; ++i)
+          correlation[i] = 0;
+      }
+
+      uint64_t taskId;
+      uint64_t correlation[PPK_ASSERT_CORRELATION_WORDS];
+      const Breadcrumb* breadcrumbs;
+    }; // AssertContext
+
+    // exchanges the calling thread's assertion context with context
+    PPK_ASSERT_FUNCSPEC
+    void PPK_ASSERT_CALL swapAssertContext(AssertContext& context);
+
+    // runs the calling thread with the task's assertion context for the
+    // lifetime of the scope, then saves the task's context, including the
+    // breadcrumbs still open when it got suspended, back into context. In the
+    // meantime, context holds the thread's own
+    class AssertContextScope
+    {
+      public:
+      explicit AssertContextScope(AssertContext& context)
+      : _context(context)
+      {
+        swapAssertContext(_context);
+      }
+
+      ~AssertContextScope()
+      {
+        swapAssertContext(_context);
+      }
+
+      private:
+      AssertContextScope(const AssertContextScope&);
+      AssertContextScope& operator = (const AssertContextScope&);
+
+      AssertContext& _context;
+    }; // AssertContextScope
+
+    // when enabled, assertions failing on the calling thread only call
+    // async-signal-safe functions: the message is formatted by a subset of
+    // printf(), written to stderr with write() and the assertion handler is
+    // bypassed. Meant for signal handlers, it's enabled automatically in the
+    // child of a multithreaded process after fork() (POSIX only)
+    PPK_ASSERT_FUNCSPEC
+    void PPK_ASSERT_CALL signalSafeAsserts(bool value);
+
+    PPK_ASSERT_FUNCSPEC
+    bool PPK_ASSERT_CALL signalSafeAsserts();
+
+    // assertions failing while their thread is already handling a failed
+    // assertion, e.g. fired by the assertion handler, are reported on stderr
+    // and ignored instead of recursing, returns how many did so far
+    PPK_ASSERT_FUNCSPEC
+    unsigned long PPK_ASSERT_CALL nestedFailures();
+
+    // in server mode, the default handler never prompts the user and ignores
+    // DEBUG failures instead, it also doesn't when stdin or stderr isn't a
+    // terminal, or without a controlling terminal. Defining
+    // PPK_ASSERT_SERVER_MODE enables server mode from the start
+    PPK_ASSERT_FUNCSPEC
+    void PPK_ASSERT_CALL serverMode(bool value);
+
+    PPK_ASSERT_FUNCSPEC
+    bool PPK_ASSERT_CALL serverMode();
+
+    // time spent in the assertion handler, including waiting for the user,
+    // in microseconds
+    struct HandlerTime
+    {
+      unsigned long calls;
+      int64_t total;
+      int64_t max;
+    }; // HandlerTime
+
+    PPK_ASSERT_FUNCSPEC
+    HandlerTime PPK_ASSERT_CALL handlerTime();
+
+    // with async dispatch, failed assertions below FATAL don't wait for the
+    // assertion handler: the failing thread acts on its own according to the
+    // dispatch policy, the subscribers and the handler are called later from
+    // a worker thread, where only the IgnoreLine, IgnoreAll and Abort answers
+    // are acted upon. FATAL failures, and failures on threads with their own
+    // handler, see HandlerScope, are still handled synchronously. Events are
+    // dropped when the queue is full (POSIX only)
+    PPK_ASSERT_FUNCSPEC
+    bool PPK_ASSERT_CALL startAsyncDispatch();
+
+    // the action failing threads take with async dispatch when the level of
+    // the failure is at least level, up to the next level given a policy,
+    // either None, Throw or Abort. By default ERROR failures throw and lower
+    // levels carry on. Returns false when the action isn't supported, or when
+    // PPK_ASSERT_DISPATCH_POLICIES levels already have a policy
+    PPK_ASSERT_FUNCSPEC
+    bool PPK_ASSERT_CALL setDispatchPolicy(int level, AssertAction::AssertAction action);
+
+    PPK_ASSERT_FUNCSPEC
+    void PPK_ASSERT_CALL stopAsyncDispatch();
+
+    PPK_ASSERT_FUNCSPEC
+    unsigned long PPK_ASSERT_CALL droppedDispatchedEvents();
+
+  #define PPK_ASSERT_DISPATCH_LATENCY_BUCKETS 16
+
+    // latency async dispatch adds to failing threads, in microseconds: bucket
+    // 0 counts the failures handled in less than a microsecond, bucket i those
+    // that took from 2^(i-1) to 2^i microseconds, the last bucket also counts
+    // the slower ones
+    struct DispatchLatency
+    {
+      unsigned long buckets[PPK_ASSERT_DISPATCH_LATENCY_BUCKETS];
+      unsigned long count;
+      int64_t total;
+      int64_t max;
+    }; // DispatchLatency
+
+    PPK_ASSERT_FUNCSPEC
+    DispatchLatency PPK_ASSERT_CALL dispatchLatency();
+
+    // the stages of handling a failed assertion, timed on the failing thread
+    namespace AssertStage {
+
+      enum AssertStage
+      {
+        Lookup,       // finding or registering the assertion site
+        Format,       // formatting the message and the breadcrumbs
+        Record,       // counters, statistics files and the flight recorder
+        Publish,      // event segment and event shipper
+        Stack,        // capturing the stack trace
+        Subscribers,
+        Handler,      // the assertion handler, including prompting the user
+        Dispatch,     // handing the failure over to the async dispatch worker
+        Throw,        // building and throwing AssertionException, up to
+                      // unwinding out of handleAssert()
+        Total,
+        Count
+
+      }; // AssertStage
+
+    } // AssertStage
+
+  #define PPK_ASSERT_LATENCY_BUCKETS 144
+
+    // HDR-style histogram of a stage's latency, in nanoseconds: buckets 0 to 3
+    // count the values 0 to 3, then each power of two is split in 4 buckets of
+    // equal width, so a bucket is never wider than a quarter of its values. The
+    // last bucket, starting at about 2 minutes, also counts the slower ones.
+    // Stages are timed with the time stamp counter when it's usable, with
+    // microsecond resolution otherwise
+    struct StageLatency
+    {
+      unsigned long buckets[PPK_ASSERT_LATENCY_BUCKETS];
+      unsigned long count;
+      int64_t total;
+      int64_t max;
+    }; // StageLatency
+
+    // latencies are kept apart for WARNING, DEBUG, ERROR and FATAL failures,
+    // custom levels are accounted with the closest standard level below them,
+    // or with WARNING
+    PPK_ASSERT_FUNCSPEC
+    StageLatency PPK_ASSERT_CALL stageLatency(int stage, int level);
+
+    // smallest latency counted by a bucket, in nanoseconds
+    PPK_ASSERT_FUNCSPEC
+    int64_t PPK_ASSERT_CALL latencyBucketBound(int bucket);
+
+    // upper bound of the latency below which the given percentage of the
+    // values fall, e.g. 99.9, in nanoseconds
+    PPK_ASSERT_FUNCSPEC
+    int64_t PPK_ASSERT_CALL latencyPercentile(const StageLatency& latency, double percentile);
+
+    // writes the count, mean, median, 99th percentile and maximum latency of
+    // each stage and level to a file descriptor, async-signal-safe
+    PPK_ASSERT_FUNCSPEC
+    void PPK_ASSERT_CALL dumpStageLatency(int fd);
+
+    // takes the cost of the first failed assertion upfront: binds the symbols
+    // resolved lazily on first use, faults in the failure path's code, its
+    // tables and the calling thread's stack, and opens the log file. When lock
+    // is true, the code and tables are also locked in memory, returns false if
+    // that failed, e.g. because of RLIMIT_MEMLOCK
+    PPK_ASSERT_FUNCSPEC
+    bool PPK_ASSERT_CALL prewarm(bool lock);
+
+    // failed assertions with a level lower than threshold are ignored,
+    // returns the previous threshold
+    PPK_ASSERT_FUNCSPEC
+    int PPK_ASSERT_CALL setAssertLevelThreshold(int level);
+
+    // serves the admin interface on a Unix domain socket, see README.md
+    PPK_ASSERT_FUNCSPEC
+    bool PPK_ASSERT_CALL startAdminServer(const char* path);
+
+    PPK_ASSERT_FUNCSPEC
+    void PPK_ASSERT_CALL stopAdminServer();
+
+  #if !defined(PPK_ASSERT_METRICS_MAX_SITES)
+    #define PPK_ASSERT_METRICS_MAX_SITES 100
+  #endif
+
+    // writes the per site counters in the Prometheus text format, sites that
+    // failed after the first maxSites ones are aggregated under file="other",
+    // returns the length of the whole text like snprintf() does
+    PPK_ASSERT_FUNCSPEC
+    size_t PPK_ASSERT_CALL writeMetrics(char* buffer, size_t size, int maxSites);
+
+    // periodically writes the metrics to path and / or serves them over HTTP on
+    // 127.0.0.1:port, path may be null and port may be 0, interval is in
+    // milliseconds
+    PPK_ASSERT_FUNCSPEC
+    bool PPK_ASSERT_CALL startMetricsExporter(const char* path, int port, int interval, int maxSites);
+
+    PPK_ASSERT_FUNCSPEC
+    void PPK_ASSERT_CALL stopMetricsExporter();
+
+    // sends the failures per site and level to a StatsD agent over UDP, batched
+    // every interval milliseconds, metric names start with prefix
+    PPK_ASSERT_FUNCSPEC
+    bool PPK_ASSERT_CALL startStatsdEmitter(const char* host, int port, const char* prefix, int interval);
+
+    // sends the pending counters right away
+    PPK_ASSERT_FUNCSPEC
+    void PPK_ASSERT_CALL flushStatsdEmitter();
+
+    PPK_ASSERT_FUNCSPEC
+    void PPK_ASSERT_CALL stopStatsdEmitter();
+
+  #if !defined(PPK_ASSERT_HEAVY_HITTER_MESSAGE_SIZE)
+    #define PPK_ASSERT_HEAVY_HITTER_MESSAGE_SIZE 64
+  #endif
+
+    struct HeavyHitter
+    {
+      unsigned long count; // upper bound, overestimated by at most error
+      unsigned long error;
+      char message[PPK_ASSERT_HEAVY_HITTER_MESSAGE_SIZE]; // numbers are masked with '#'
+    }; // HeavyHitter
+
+    // returns the number of heavy hitters written, sorted by decreasing count
+    PPK_ASSERT_FUNCSPEC
+    int PPK_ASSERT_CALL heavyHitters(const char* file, int line, HeavyHitter* hitters, int count);
+
+    PPK_ASSERT_FUNCSPEC
+    void PPK_ASSERT_CALL dumpHeavyHitters();
+
+  #define PPK_ASSERT_STATS_MAGIC "PPKSTATS"
+  #define PPK_ASSERT_STATS_VERSION 1
+
+  #if !defined(PPK_ASSERT_STATS_CAPACITY)
+    #define PPK_ASSERT_STATS_CAPACITY 1024
+  #endif
+
+    // layout of the statistics table mapped by openStatsFile() and
+    // openStatsSegment(): a header followed by capacity records, so that
+    // external tools can read it
+    struct StatsHeader
+    {
+      char magic[8];
+      uint32_t version;
+      uint32_t capacity;
+      uint64_t overflow; // failures not recorded because the table is full
+    }; // StatsHeader
+
+    struct StatsRecord
+    {
+      uint64_t hash; // hash of file, line and expression, 0 for empty slots
+      uint64_t failures;
+      int64_t lastSeen; // seconds since epoch
+      int32_t line;
+      int32_t level;
+      char file[96];
+      char expression[128];
+    }; // StatsRecord
+
+    // maps per site failure counters onto a file so that they accumulate
+    // across process restarts, returns false if the file can't be mapped
+    PPK_ASSERT_FUNCSPEC
+    bool PPK_ASSERT_CALL openStatsFile(const char* path);
+
+    // maps per site failure counters onto a POSIX shared memory segment, e.g.
+    // "/myapp.assert", shared by all the processes opening the same name
+    PPK_ASSERT_FUNCSPEC
+    bool PPK_ASSERT_CALL openStatsSegment(const char* name);
+
+  #define PPK_ASSERT_EVENTS_MAGIC "PPKEVNTS"
+  #define PPK_ASSERT_EVENTS_VERSION 3
+
+  #if !defined(PPK_ASSERT_EVENT_RINGS)
+    #define PPK_ASSERT_EVENT_RINGS 16
+  #endif
+
+  #if !defined(PPK_ASSERT_EVENT_RING_SIZE)
+    #define PPK_ASSERT_EVENT_RING_SIZE 64
+  #endif
+
+    // fixed size record describing a failed assertion
+    struct EventRecord
+    {
+      uint64_t sequence; // position in the ring + 1, 0 while being written
+      int64_t time; // microseconds since epoch
+      uint64_t threadId;
+      int32_t processId;
+      int32_t line;
+      int32_t level;
+      int32_t reserved;
+      uint64_t correlation[PPK_ASSERT_CORRELATION_WORDS]; // see setCorrelation()
+      uint64_t taskId; // see AssertContext, 0 outside of tasks
+      char file[64];
+      char function[128];
+      char expression[128];
+      char message[192];
+    }; // EventRecord
+
+    // single writer ring, the writer never waits for readers which instead
+    // detect events that were overwritten before they could read them
+    struct EventRing
+    {
+      uint64_t owner; // process id << 32 | thread token, 0 when available
+      uint64_t head; // number of events ever written
+      EventRecord records[PPK_ASSERT_EVENT_RING_SIZE];
+    }; // EventRing
+
+    // layout of the event segment mapped by openEventSegment(): a header
+    // followed by rings
+    struct EventsHeader
+    {
+      char magic[8];
+      uint32_t version;
+      uint32_t rings;
+      uint32_t ringSize;
+      uint32_t recordSize;
+    }; // EventsHeader
+
+    // publishes failed assertions to a POSIX shared memory segment, each
+    // thread writing to its own ring
+    PPK_ASSERT_FUNCSPEC
+    bool PPK_ASSERT_CALL openEventSegment(const char* name);
+
+  // the event shipper sends the magic number once connected, then one frame
+  // per event, integers being little endian:
+  //   uint32 size of the rest of the frame
+  //   int64 time, uint64 thread id, int32 process id, int32 line, int32 level
+  //   uint64 correlation words, uint64 task id
+  //   file, function, expression and message: uint16 length then the bytes
+  #define PPK_ASSERT_SHIPPER_MAGIC "PPKSHIP3"
+
+    // streams failed assertions to a collector listening on a Unix domain
+    // socket path or on host:port, in batches sent every interval milliseconds
+    PPK_ASSERT_FUNCSPEC
+    bool PPK_ASSERT_CALL startEventShipper(const char* address, int interval);
+
+    PPK_ASSERT_FUNCSPEC
+    void PPK_ASSERT_CALL stopEventShipper();
+
+    // events dropped because the queue was full, e.g. while the collector is
+    // unreachable
+    PPK_ASSERT_FUNCSPEC
+    unsigned long PPK_ASSERT_CALL droppedShippedEvents();
+
+    // writes the last failed assertions kept in memory to a file descriptor,
+    // oldest first, async-signal-safe
+    PPK_ASSERT_FUNCSPEC
+    void PPK_ASSERT_CALL dumpFlightRecorder(int fd);
+
+    // on fatal signals, dumps the last failed assertions to path, or to stderr
+    // when path is null, then re-raises the signal
+    PPK_ASSERT_FUNCSPEC
+    bool PPK_ASSERT_CALL installCrashHandler(const char* path);
+
+    // observes the failed assertions passed to the assertion handler, called
+    // before it from the thread the assertion failed in
+    typedef void (PPK_ASSERT_CALL *AssertSubscriber)(const EventRecord& event, void* context);
+
+    // subscribers can be added and removed while assertions fail on other
+    // threads without blocking them. Once unsubscribe() returns, the
+    // subscriber isn't running anymore and won't be called again, so that its
+    // code can be unloaded. Both return false when called from a subscriber
+    // or an assertion handler
+    PPK_ASSERT_FUNCSPEC
+    bool PPK_ASSERT_CALL subscribe(AssertSubscriber subscriber, void* context);
+
+    PPK_ASSERT_FUNCSPEC
+    bool PPK_ASSERT_CALL unsubscribe(AssertSubscriber subscriber, void* context);
+
+    // returns the failed assertion being handled by the current thread, or
+    // null outside of the assertion handler and the subscribers, e.g. for the
+    // handler to read the correlation words. With async dispatch, it's the
+    // worker thread that handles it
+    PPK_ASSERT_FUNCSPEC
+    const EventRecord* PPK_ASSERT_CALL currentEvent();
+
+  #define PPK_ASSERT_JOURNAL_MAGIC "PPKJRNL1"
+  #define PPK_ASSERT_JOURNAL_VERSION 3
+
+    // describes where the flight recorder and the site table live so that
+    // debuggers can find them in core files, see tools/ppk_assert_gdb.py,
+    // flight recorder entries are a sequence number followed by an EventRecord
+    struct Journal
+    {
+      char magic[8];
+      uint32_t version;
+      uint32_t pointerSize;
+      uint32_t longSize;
+      uint32_t eventCount;
+      uint32_t eventStride;
+      uint32_t eventSequenceOffset; // position in the flight recorder + 1
+      uint32_t eventOffset;
+      uint32_t siteCount;
+      uint32_t siteStride;
+      uint32_t siteReadyOffset;
+      uint32_t siteFileOffset; // const char*
+      uint32_t siteLineOffset; // int
+      uint32_t siteExpressionOffset; // const char*
+      uint32_t siteLevelOffset; // int
+      uint32_t siteFailuresOffset; // long
+      uint32_t reserved;
+      const void* events;
+      const volatile long* eventHead; // number of events ever recorded
+      const void* sites;
+    }; // Journal
+
+    extern "C" PPK_ASSERT_FUNCSPEC const Journal ppk_assert_journal;
+
+  #if !defined(PPK_ASSERT_STACK_DEPTH)
+    #define PPK_ASSERT_STACK_DEPTH 32
+  #endif
+
+    struct StackTrace
+    {
+      unsigned long hash; // identical stacks share the same hash
+      unsigned long occurrences; // failures with the same stack so far, 0 if unknown
+      int depth;
+      void* frames[PPK_ASSERT_STACK_DEPTH > 0 ? PPK_ASSERT_STACK_DEPTH : 1]; // return addresses, innermost first
+    }; // StackTrace
+
+    // returns the raw stack of the failed assertion being handled by the
+    // current thread, or null outside of the assertion handler
+    PPK_ASSERT_FUNCSPEC
+    const StackTrace* PPK_ASSERT_CALL currentStackTrace();
+
+    // returns a description of the function containing pc, symbols are cached
+    // so that each distinct pc is symbolized once
+    PPK_ASSERT_FUNCSPEC
+    const char* PPK_ASSERT_CALL symbolize(const void* pc);
+
   #if defined(PPK_ASSERT_CXX11)
 
     template<int level, typename T>
@@ -616,6 +1413,18 @@
 
 #endif
 
+#undef PPK_ASSERT_CONTEXT
+
+#if PPK_ASSERT_ENABLED
+
+  #define PPK_ASSERT_CONTEXT(...) ppk::assert::implementation::Breadcrumb PPK_ASSERT_JOIN(ppk_assert_breadcrumb_, PPK_ASSERT_LINE)(__VA_ARGS__)
+
+#else
+
+  #define PPK_ASSERT_CONTEXT(...) ((void)0)
+
+#endif
+
 #if (defined(__GNUC__) && ((__GNUC__ * 1000 + __GNUC_MINOR__ * 100) >= 4600)) || defined(__clang__)
   #pragma GCC diagnostic pop
 #endif
@@ -3,9 +3,23 @@
 #define PPK_ASSERT_ENABLED 1
 #include <ppk_assert.h>
 
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 
 using namespace ppk::assert;
 
@@ -14,6 +28,7 @@ namespace {
   namespace implementation = ppk::assert::implementation;
   namespace AssertLevel = implementation::AssertLevel;
   namespace AssertAction = implementation::AssertAction;
+  namespace AssertStage = implementation::AssertStage;
 
   const char* _file;
   int _line;
@@ -335,6 +350,1240 @@ namespace {
 #endif
   }
 
+#if defined(PPK_ASSERT_HEAVY_HITTERS)
+  TEST_F(AssertTest, heavyHitters)
+  {
+    int line = 0;
+
+    for (int i = 0; i < 20; ++i)
+    {
+      PPK_ASSERT_WARNING(false, i % 4 ? "unknown id: %d" : "invalid value: 0x%x", 1000 + i); line = PPK_ASSERT_LINE;
+    }
+
+    implementation::HeavyHitter hitters[4];
+    EXPECT_EQ(2, implementation::heavyHitters("ppk_assert_test.cpp", line, hitters, 4));
+    EXPECT_EQ(15ul, hitters[0].count);
+    EXPECT_STREQ("unknown id: #", hitters[0].message);
+    EXPECT_EQ(5ul, hitters[1].count);
+    EXPECT_STREQ("invalid value: #", hitters[1].message);
+
+    EXPECT_EQ(1, implementation::heavyHitters("ppk_assert_test.cpp", line, hitters, 1));
+    EXPECT_EQ(1, implementation::heavyHitters("test/ppk_assert_test.cpp", line, hitters, 1));
+    EXPECT_EQ(0, implementation::heavyHitters("ppk_assert_test.cpp", 0, hitters, 4));
+  }
+#endif
+
+#if !defined(_WIN32)
+  TEST_F(AssertTest, statsFile)
+  {
+    struct Local
+    {
+      static int f()
+      {
+        PPK_ASSERT_WARNING(false, "persisted"); return PPK_ASSERT_LINE;
+      }
+    };
+
+    char path[] = "/tmp/ppk_assert_test.XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(-1, fd);
+    close(fd);
+
+    ASSERT_TRUE(implementation::openStatsFile(path));
+    Local::f();
+    Local::f();
+
+    // counters accumulate once the file is mapped again, e.g. after a restart
+    ASSERT_TRUE(implementation::openStatsFile(path));
+    int line = Local::f();
+
+    FILE* f = fopen(path, "rb");
+    ASSERT_TRUE(f != PPK_ASSERT_NULLPTR);
+
+    implementation::StatsHeader header;
+    ASSERT_EQ(1u, fread(&header, sizeof(header), 1, f));
+    EXPECT_EQ(0, memcmp(PPK_ASSERT_STATS_MAGIC, header.magic, sizeof(header.magic)));
+    EXPECT_EQ(static_cast<uint32_t>(PPK_ASSERT_STATS_VERSION), header.version);
+
+    uint64_t failures = 0;
+    implementation::StatsRecord record;
+    for (uint32_t i = 0; i < header.capacity && fread(&record, sizeof(record), 1, f) == 1; ++i)
+    {
+      if (record.hash && record.line == line && strcmp(record.file, "ppk_assert_test.cpp") == 0)
+      {
+        failures = record.failures;
+        EXPECT_STREQ("false", record.expression);
+        EXPECT_EQ(AssertLevel::Warning, record.level);
+        EXPECT_LT(0, record.lastSeen);
+      }
+    }
+    EXPECT_EQ(3u, failures);
+
+    fclose(f);
+    unlink(path);
+  }
+#endif
+
+#if !defined(_WIN32) && !defined(__ANDROID__)
+  TEST_F(AssertTest, statsSegment)
+  {
+    char name[64];
+    snprintf(name, sizeof(name), "/ppk_assert_test.%d", static_cast<int>(getpid()));
+
+    ASSERT_TRUE(implementation::openStatsSegment(name));
+    PPK_ASSERT_WARNING(false, "shared");
+    int line = PPK_ASSERT_LINE - 1;
+
+    // another worker process mapping the same segment
+    int fd = shm_open(name, O_RDONLY, 0);
+    ASSERT_NE(-1, fd);
+
+    const size_t size = sizeof(implementation::StatsHeader) + PPK_ASSERT_STATS_CAPACITY * sizeof(implementation::StatsRecord);
+    void* p = mmap(PPK_ASSERT_NULLPTR, size, PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NE(MAP_FAILED, p);
+    close(fd);
+
+    const implementation::StatsHeader* header = static_cast<const implementation::StatsHeader*>(p);
+    const implementation::StatsRecord* records = reinterpret_cast<const implementation::StatsRecord*>(header + 1);
+    EXPECT_EQ(static_cast<uint32_t>(PPK_ASSERT_STATS_CAPACITY), header->capacity);
+
+    uint64_t failures = 0;
+    for (uint32_t i = 0; i < header->capacity; ++i)
+    {
+      if (records[i].hash && records[i].line == line && strcmp(records[i].file, "ppk_assert_test.cpp") == 0)
+        failures = records[i].failures;
+    }
+    EXPECT_EQ(1u, failures);
+
+    munmap(p, size);
+    shm_unlink(name);
+  }
+#endif
+
+#if !defined(_WIN32) && !defined(__ANDROID__)
+  TEST_F(AssertTest, eventSegment)
+  {
+    char name[64];
+    snprintf(name, sizeof(name), "/ppk_assert_test.events.%d", static_cast<int>(getpid()));
+
+    ASSERT_TRUE(implementation::openEventSegment(name));
+    PPK_ASSERT_WARNING(false, "first event");
+    PPK_ASSERT_WARNING(false, "second event");
+    int line = PPK_ASSERT_LINE - 1;
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    ASSERT_NE(-1, fd);
+
+    const size_t size = sizeof(implementation::EventsHeader) + PPK_ASSERT_EVENT_RINGS * sizeof(implementation::EventRing);
+    void* p = mmap(PPK_ASSERT_NULLPTR, size, PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NE(MAP_FAILED, p);
+    close(fd);
+
+    const implementation::EventsHeader* header = static_cast<const implementation::EventsHeader*>(p);
+    const implementation::EventRing* rings = reinterpret_cast<const implementation::EventRing*>(header + 1);
+    EXPECT_EQ(static_cast<uint32_t>(sizeof(implementation::EventRecord)), header->recordSize);
+
+    const implementation::EventRing* ring = PPK_ASSERT_NULLPTR;
+    for (uint32_t i = 0; i < header->rings; ++i)
+    {
+      if (static_cast<pid_t>(rings[i].owner >> 32) == getpid())
+        ring = &rings[i];
+    }
+    ASSERT_TRUE(ring != PPK_ASSERT_NULLPTR);
+    ASSERT_EQ(2u, ring->head);
+
+    EXPECT_EQ(1u, ring->records[0].sequence);
+    EXPECT_STREQ("first event", ring->records[0].message);
+    EXPECT_EQ(2u, ring->records[1].sequence);
+    EXPECT_STREQ("second event", ring->records[1].message);
+    EXPECT_STREQ("ppk_assert_test.cpp", ring->records[1].file);
+    EXPECT_EQ(line, ring->records[1].line);
+    EXPECT_EQ(getpid(), ring->records[1].processId);
+
+    munmap(p, size);
+    shm_unlink(name);
+  }
+#endif
+
+#if !defined(_WIN32)
+  // sends a command and returns the response, up to the final ok or error line
+  const char* adminCommand(int fd, const char* command)
+  {
+    static char response[4096];
+    size_t length = 0;
+
+    if (send(fd, command, strlen(command), 0) != static_cast<ssize_t>(strlen(command)))
+      return "";
+
+    for (;;)
+    {
+      ssize_t n = recv(fd, response + length, sizeof(response) - 1 - length, 0);
+      if (n <= 0)
+        break;
+
+      length += static_cast<size_t>(n);
+      response[length] = 0;
+
+      if (strcmp(response + length - 3, "ok\n") == 0 || strstr(response, "error"))
+        break;
+    }
+
+    response[length] = 0;
+    return response;
+  }
+
+  TEST_F(AssertTest, adminServer)
+  {
+    struct Local
+    {
+      static int f()
+      {
+        PPK_ASSERT_WARNING(false, "noisy"); return PPK_ASSERT_LINE;
+      }
+    };
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/ppk_assert_test.%d.sock", static_cast<int>(getpid()));
+
+    // refuses to replace something that isn't a socket
+    int file = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    ASSERT_NE(-1, file);
+    close(file);
+    EXPECT_FALSE(implementation::startAdminServer(path));
+    EXPECT_EQ(0, access(path, F_OK));
+    unlink(path);
+
+    ASSERT_TRUE(implementation::startAdminServer(path));
+
+    struct stat status;
+    ASSERT_EQ(0, lstat(path, &status));
+    EXPECT_EQ(0600, static_cast<int>(status.st_mode & 0777));
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    ASSERT_EQ(0, connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)));
+
+    int line = Local::f();
+
+    char site[64];
+    snprintf(site, sizeof(site), "ppk_assert_test.cpp:%d 'false'", line);
+    const char* list = adminCommand(fd, "list\n");
+    const char* entry = strstr(list, site);
+    ASSERT_TRUE(entry != PPK_ASSERT_NULLPTR);
+
+    // rewind to the beginning of the line to get the site id
+    while (entry > list && entry[-1] != '\n')
+      --entry;
+
+    char id[9] = {0};
+    memcpy(id, entry, 8);
+
+    char command[64];
+    snprintf(command, sizeof(command), "mute %s\n", id);
+    EXPECT_STREQ("ok\n", adminCommand(fd, command));
+
+    _line = 0;
+    Local::f();
+    EXPECT_EQ(0, _line);
+
+    snprintf(command, sizeof(command), "unmute %s\n", id);
+    EXPECT_STREQ("ok\n", adminCommand(fd, command));
+
+    Local::f();
+    EXPECT_EQ(line, _line);
+
+    EXPECT_STREQ("ok\n", adminCommand(fd, "level error\n"));
+    _line = 0;
+    Local::f();
+    EXPECT_EQ(0, _line);
+    EXPECT_EQ(AssertLevel::Error, implementation::setAssertLevelThreshold(0));
+
+#if !defined(PPK_ASSERT_DISABLE_IGNORE_LINE)
+    // unmuting doesn't undo an IgnoreLine answer
+    _action = AssertAction::IgnoreLine;
+    Local::f();
+    _action = AssertAction::None;
+
+    snprintf(command, sizeof(command), "mute %s\n", id);
+    EXPECT_STREQ("ok\n", adminCommand(fd, command));
+    snprintf(command, sizeof(command), "unmute %s\n", id);
+    EXPECT_STREQ("ok\n", adminCommand(fd, command));
+
+    _line = 0;
+    Local::f();
+    EXPECT_EQ(0, _line);
+#endif
+
+    EXPECT_STREQ("ok\n", adminCommand(fd, "ignore-all on\n"));
+    EXPECT_TRUE(implementation::ignoreAllAsserts());
+    EXPECT_STREQ("ok\n", adminCommand(fd, "ignore-all off\n"));
+    EXPECT_FALSE(implementation::ignoreAllAsserts());
+
+    EXPECT_TRUE(strstr(adminCommand(fd, "stats\n"), "ignore-all off\n") != PPK_ASSERT_NULLPTR);
+    EXPECT_TRUE(strstr(adminCommand(fd, "mute 0\n"), "error") != PPK_ASSERT_NULLPTR);
+
+    close(fd);
+    implementation::stopAdminServer();
+    EXPECT_NE(0, access(path, F_OK));
+  }
+#endif
+
+  TEST_F(AssertTest, metrics)
+  {
+    struct Local
+    {
+      static int f()
+      {
+        PPK_ASSERT_WARNING(false, "metrics"); return PPK_ASSERT_LINE;
+      }
+    };
+
+    int line = Local::f();
+    implementation::setAssertLevelThreshold(AssertLevel::Error);
+    Local::f();
+    implementation::setAssertLevelThreshold(0);
+
+    char failures[128];
+    snprintf(failures, sizeof(failures), "ppk_assert_failures_total{file=\"ppk_assert_test.cpp\",line=\"%d\",level=\"WARNING\"} 1\n", line);
+    char suppressed[128];
+    snprintf(suppressed, sizeof(suppressed), "ppk_assert_suppressed_total{file=\"ppk_assert_test.cpp\",line=\"%d\",level=\"WARNING\"} 1\n", line);
+
+    static char buffer[65536];
+    size_t length = implementation::writeMetrics(buffer, sizeof(buffer), PPK_ASSERT_METRICS_MAX_SITES);
+    ASSERT_LT(length, sizeof(buffer));
+    EXPECT_EQ(strlen(buffer), length);
+    EXPECT_TRUE(strstr(buffer, "# TYPE ppk_assert_thrown_total counter\n") != PPK_ASSERT_NULLPTR);
+    EXPECT_TRUE(strstr(buffer, failures) != PPK_ASSERT_NULLPTR);
+    EXPECT_TRUE(strstr(buffer, suppressed) != PPK_ASSERT_NULLPTR);
+
+    // no room for any site, everything is aggregated
+    implementation::writeMetrics(buffer, sizeof(buffer), 0);
+    EXPECT_TRUE(strstr(buffer, failures) == PPK_ASSERT_NULLPTR);
+    EXPECT_TRUE(strstr(buffer, "ppk_assert_failures_total{file=\"other\",line=\"0\",level=\"WARNING\"} ") != PPK_ASSERT_NULLPTR);
+
+    char small[16];
+    EXPECT_EQ(length, implementation::writeMetrics(small, sizeof(small), PPK_ASSERT_METRICS_MAX_SITES));
+    EXPECT_EQ(sizeof(small) - 1, strlen(small));
+
+#if !defined(_WIN32)
+    char path[] = "/tmp/ppk_assert_test.XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(-1, fd);
+    close(fd);
+
+    ASSERT_TRUE(implementation::startMetricsExporter(path, 0, 60 * 1000, PPK_ASSERT_METRICS_MAX_SITES));
+    implementation::stopMetricsExporter();
+
+    FILE* f = fopen(path, "rb");
+    ASSERT_TRUE(f != PPK_ASSERT_NULLPTR);
+    buffer[fread(buffer, 1, sizeof(buffer) - 1, f)] = 0;
+    fclose(f);
+    unlink(path);
+
+    EXPECT_TRUE(strstr(buffer, failures) != PPK_ASSERT_NULLPTR);
+#endif
+  }
+
+#if !defined(_WIN32)
+  TEST_F(AssertTest, statsdEmitter)
+  {
+    struct Local
+    {
+      static int f()
+      {
+        PPK_ASSERT_WARNING(false, "statsd"); return PPK_ASSERT_LINE;
+      }
+    };
+
+    // stands in for the StatsD agent
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    ASSERT_EQ(0, bind(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)));
+    ASSERT_EQ(0, getsockname(fd, reinterpret_cast<struct sockaddr*>(&address), &length));
+
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    ASSERT_TRUE(implementation::startStatsdEmitter("127.0.0.1", ntohs(address.sin_port), "test", 60 * 1000));
+    implementation::flushStatsdEmitter(); // failures of the previous tests
+
+    char datagram[2048];
+    while (recv(fd, datagram, sizeof(datagram), MSG_DONTWAIT) > 0)
+      ;
+
+    int line = Local::f();
+    Local::f();
+    implementation::flushStatsdEmitter();
+
+    ssize_t n = recv(fd, datagram, sizeof(datagram) - 1, 0);
+    ASSERT_LT(0, n);
+    datagram[n] = 0;
+
+    char expected[128];
+    snprintf(expected, sizeof(expected), "test.failures.warning.ppk_assert_test_cpp.%d:2|c\n", line);
+    EXPECT_STREQ(expected, datagram);
+
+    // nothing is sent when nothing failed
+    implementation::flushStatsdEmitter();
+    EXPECT_GT(0, recv(fd, datagram, sizeof(datagram), MSG_DONTWAIT));
+
+    implementation::stopStatsdEmitter();
+    close(fd);
+  }
+
+  TEST_F(AssertTest, eventShipper)
+  {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/ppk_assert_test.%d.collector", static_cast<int>(getpid()));
+    unlink(path);
+
+    // the collector isn't listening yet, events are queued
+    ASSERT_TRUE(implementation::startEventShipper(path, 10));
+    PPK_ASSERT_WARNING(false, "shipped");
+    int line = PPK_ASSERT_LINE - 1;
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    ASSERT_EQ(0, bind(server, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)));
+    ASSERT_EQ(0, listen(server, 1));
+
+    int fd = accept(server, PPK_ASSERT_NULLPTR, PPK_ASSERT_NULLPTR);
+    ASSERT_NE(-1, fd);
+
+    struct timeval timeout = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    unsigned char frame[1024];
+    ASSERT_EQ(12, recv(fd, frame, 12, MSG_WAITALL));
+    EXPECT_EQ(0, memcmp(PPK_ASSERT_SHIPPER_MAGIC, frame, 8));
+
+    size_t size = frame[8] | frame[9] << 8 | frame[10] << 16 | frame[11] << 24;
+    ASSERT_LT(size, sizeof(frame));
+    ASSERT_EQ(static_cast<ssize_t>(size), recv(fd, frame, size, MSG_WAITALL));
+
+    int32_t line_ = frame[20] | frame[21] << 8 | frame[22] << 16 | frame[23] << 24;
+    EXPECT_EQ(line, line_);
+
+    // correlation words, task id, file, function, expression then message
+    const unsigned char* p = frame + 28 + 8 * PPK_ASSERT_CORRELATION_WORDS + 8;
+    for (int i = 0; i < 3; ++i)
+      p += 2 + (p[0] | p[1] << 8);
+    EXPECT_EQ(7, p[0] | p[1] << 8);
+    EXPECT_EQ(0, memcmp("shipped", p + 2, 7));
+
+    implementation::stopEventShipper();
+    EXPECT_EQ(0u, implementation::droppedShippedEvents());
+
+    close(fd);
+    close(server);
+    unlink(path);
+  }
+
+  TEST_F(AssertTest, crashHandler)
+  {
+    char path[] = "/tmp/ppk_assert_test.XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(-1, fd);
+    close(fd);
+
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+
+    if (pid == 0)
+    {
+      implementation::installCrashHandler(path);
+      PPK_ASSERT_WARNING(false, "nobody read me");
+      abort();
+    }
+
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFSIGNALED(status));
+    EXPECT_EQ(SIGABRT, WTERMSIG(status));
+
+    char buffer[16384];
+    FILE* f = fopen(path, "rb");
+    ASSERT_TRUE(f != PPK_ASSERT_NULLPTR);
+    buffer[fread(buffer, 1, sizeof(buffer) - 1, f)] = 0;
+    fclose(f);
+    unlink(path);
+
+    EXPECT_EQ(buffer, strstr(buffer, "*** received signal 6, last failed assertions:\n"));
+    EXPECT_TRUE(strstr(buffer, "] Assertion 'false' failed (WARNING) in file ppk_assert_test.cpp") != PPK_ASSERT_NULLPTR);
+    EXPECT_TRUE(strstr(buffer, ", with message: nobody read me\n") != PPK_ASSERT_NULLPTR);
+  }
+
+  TEST_F(AssertTest, crashHandlerInstalledTwice)
+  {
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+
+    if (pid == 0)
+    {
+      int null = open("/dev/null", O_WRONLY);
+      dup2(null, STDERR_FILENO);
+      alarm(5); // dies of SIGALRM instead of looping if the handler chains to itself
+
+      implementation::installCrashHandler(PPK_ASSERT_NULLPTR);
+      implementation::installCrashHandler(PPK_ASSERT_NULLPTR);
+      abort();
+    }
+
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFSIGNALED(status));
+    EXPECT_EQ(SIGABRT, WTERMSIG(status));
+  }
+
+  void* _idleThread(void* fd)
+  {
+    char c;
+    (void)read(*static_cast<int*>(fd), &c, 1);
+
+    return PPK_ASSERT_NULLPTR;
+  }
+
+  TEST_F(AssertTest, signalSafe)
+  {
+    char path[] = "/tmp/ppk_assert_test.XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(-1, fd);
+
+    // the handler is bypassed, the message goes straight to stderr
+    int savedStderr = dup(STDERR_FILENO);
+    dup2(fd, STDERR_FILENO);
+
+    implementation::signalSafeAsserts(true);
+    const char unterminated[] = {'o', 'k'};
+    PPK_ASSERT_WARNING(false, "%s %.3s %.*s %d %ld %u %x %c %.2f %p %%", "s", "string", 2, unterminated, -42, 7L, 42u, 255u, 'c', 3.14159, reinterpret_cast<void*>(0x10));
+    implementation::signalSafeAsserts(false);
+
+    dup2(savedStderr, STDERR_FILENO);
+    close(savedStderr);
+
+    EXPECT_TRUE(_message == PPK_ASSERT_NULLPTR);
+
+    char buffer[4096];
+    ssize_t n = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    ASSERT_LT(0, n);
+    buffer[n] = 0;
+    close(fd);
+    unlink(path);
+
+    EXPECT_EQ(buffer, strstr(buffer, "*** signal-safe "));
+    EXPECT_TRUE(strstr(buffer, ", with message: s str ok -42 7 42 ff c 3.14 0x10 %\n") != PPK_ASSERT_NULLPTR);
+
+    // the child of a multithreaded process switches to signal-safe mode
+    int pipes[2];
+    ASSERT_EQ(0, pipe(pipes));
+
+    pthread_t thread;
+    ASSERT_EQ(0, pthread_create(&thread, PPK_ASSERT_NULLPTR, _idleThread, &pipes[0]));
+
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+
+    if (pid == 0)
+      _exit(implementation::signalSafeAsserts() ? 0 : 1);
+
+    close(pipes[1]);
+    pthread_join(thread, PPK_ASSERT_NULLPTR);
+    close(pipes[0]);
+
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+    EXPECT_FALSE(implementation::signalSafeAsserts());
+
+    // DEBUG failures don't break into a debugger that isn't attached
+    pid = fork();
+    ASSERT_NE(-1, pid);
+
+    if (pid == 0)
+    {
+      dup2(open("/dev/null", O_WRONLY), STDERR_FILENO);
+      implementation::signalSafeAsserts(true);
+      PPK_ASSERT_DEBUG(false, "survived");
+      _exit(0);
+    }
+
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+  }
+#endif
+
+  TEST_F(AssertTest, journal)
+  {
+    PPK_ASSERT_WARNING(false, "journaled");
+    int line = PPK_ASSERT_LINE - 1;
+
+    const implementation::Journal& journal = implementation::ppk_assert_journal;
+    ASSERT_EQ(0, memcmp(PPK_ASSERT_JOURNAL_MAGIC, journal.magic, sizeof(journal.magic)));
+    EXPECT_EQ(static_cast<uint32_t>(PPK_ASSERT_JOURNAL_VERSION), journal.version);
+    ASSERT_EQ(sizeof(long), journal.longSize);
+
+    // what a debugger does, only following the offsets
+    long head = *journal.eventHead;
+    ASSERT_LT(0, head);
+    const char* record = static_cast<const char*>(journal.events) + ((head - 1) % journal.eventCount) * journal.eventStride;
+    EXPECT_EQ(head, *reinterpret_cast<const long*>(record + journal.eventSequenceOffset));
+    const implementation::EventRecord* event = reinterpret_cast<const implementation::EventRecord*>(record + journal.eventOffset);
+    EXPECT_STREQ("journaled", event->message);
+    EXPECT_EQ(line, event->line);
+
+    long failures = 0;
+    for (uint32_t i = 0; i < journal.siteCount; ++i)
+    {
+      const char* site = static_cast<const char*>(journal.sites) + i * journal.siteStride;
+
+      if (*reinterpret_cast<const long*>(site + journal.siteReadyOffset)
+       && *reinterpret_cast<const int*>(site + journal.siteLineOffset) == line
+       && strcmp(*reinterpret_cast<const char* const*>(site + journal.siteFileOffset), "ppk_assert_test.cpp") == 0)
+      {
+        EXPECT_STREQ("false", *reinterpret_cast<const char* const*>(site + journal.siteExpressionOffset));
+        EXPECT_EQ(AssertLevel::Warning, *reinterpret_cast<const int*>(site + journal.siteLevelOffset));
+        failures = *reinterpret_cast<const long*>(site + journal.siteFailuresOffset);
+      }
+    }
+    EXPECT_EQ(1, failures);
+  }
+
+  implementation::StackTrace _stackTrace;
+
+  AssertAction::AssertAction _stackTraceHandler(const char*, int, const char*, const char*, int, const char*)
+  {
+    const implementation::StackTrace* current = implementation::currentStackTrace();
+    _stackTrace.depth = -1;
+
+    if (current)
+      _stackTrace = *current;
+
+    return AssertAction::None;
+  }
+
+  TEST_F(AssertTest, stackTrace)
+  {
+    struct Local
+    {
+      static void helper()
+      {
+        PPK_ASSERT_WARNING(false, "shared helper");
+      }
+
+      static void caller1() { helper(); }
+      static void caller2() { helper(); }
+    };
+
+    EXPECT_TRUE(implementation::currentStackTrace() == PPK_ASSERT_NULLPTR);
+    implementation::setAssertHandler(_stackTraceHandler);
+
+#if defined(__GLIBC__) || defined(__APPLE__) || defined(_WIN32)
+    unsigned long hashes[2];
+    for (int i = 0; i < 2; ++i)
+    {
+      Local::caller1();
+      ASSERT_LT(0, _stackTrace.depth);
+      EXPECT_EQ(static_cast<unsigned long>(i + 1), _stackTrace.occurrences);
+      hashes[0] = _stackTrace.hash;
+
+      Local::caller2();
+      EXPECT_EQ(static_cast<unsigned long>(i + 1), _stackTrace.occurrences);
+      hashes[1] = _stackTrace.hash;
+    }
+    EXPECT_NE(hashes[0], hashes[1]);
+
+    // cached, the same pointer is returned
+    const char* symbol = implementation::symbolize(_stackTrace.frames[0]);
+    EXPECT_NE(0u, strlen(symbol));
+    EXPECT_EQ(symbol, implementation::symbolize(_stackTrace.frames[0]));
+#else
+    Local::caller1();
+    EXPECT_EQ(0, _stackTrace.depth);
+#endif
+  }
+
+#if !defined(PPK_ASSERT_DISABLE_EXCEPTIONS)
+  AssertAction::AssertAction _throwingHandler(const char*, int, const char*, const char*, int, const char*)
+  {
+    return AssertAction::Throw;
+  }
+
+  TEST_F(AssertTest, exceptionStackTrace)
+  {
+    implementation::setAssertHandler(_throwingHandler);
+
+    try
+    {
+      PPK_ASSERT_ERROR(false, "caught far away");
+      FAIL();
+    }
+    catch (const AssertionException& e)
+    {
+#if defined(__GLIBC__) || defined(__APPLE__) || defined(_WIN32)
+      ASSERT_LT(0, e.stackDepth());
+      EXPECT_GE(PPK_ASSERT_EXCEPTION_STACK_DEPTH, e.stackDepth());
+
+      AssertionException copy(e);
+      EXPECT_EQ(e.stackDepth(), copy.stackDepth());
+      EXPECT_EQ(e.stackFrame(0), copy.stackFrame(0));
+
+      // formatted once
+      const char* trace = e.stackTrace();
+      EXPECT_TRUE(strstr(trace, "#0 ") == trace);
+      EXPECT_EQ(trace, e.stackTrace());
+      EXPECT_STREQ(trace, copy.stackTrace());
+#else
+      EXPECT_EQ(0, e.stackDepth());
+      EXPECT_STREQ("", e.stackTrace());
+#endif
+    }
+  }
+#endif
+
+  int _reentrantCalls = 0;
+
+  AssertAction::AssertAction _reentrantHandler(const char*, int, const char*, const char*, int, const char*)
+  {
+    ++_reentrantCalls;
+    PPK_ASSERT_WARNING(false, "fired by the handler");
+
+    return AssertAction::None;
+  }
+
+  TEST_F(AssertTest, reentrancy)
+  {
+    implementation::setAssertHandler(_reentrantHandler);
+    unsigned long nested = implementation::nestedFailures();
+
+    PPK_ASSERT_WARNING(false);
+    EXPECT_EQ(1, _reentrantCalls);
+    EXPECT_EQ(nested + 1, implementation::nestedFailures());
+
+    // the guard is released
+    PPK_ASSERT_WARNING(false);
+    EXPECT_EQ(2, _reentrantCalls);
+    EXPECT_EQ(nested + 2, implementation::nestedFailures());
+  }
+
+  TEST_F(AssertTest, prewarm)
+  {
+    EXPECT_TRUE(implementation::prewarm(false));
+
+    PPK_ASSERT_WARNING(false, "after prewarm %d", 1);
+    EXPECT_EQ(PPK_ASSERT_LINE - 1, _line);
+    EXPECT_STREQ("after prewarm 1", _message);
+  }
+
+#if !defined(_WIN32)
+  AssertAction::AssertAction _slowHandler(const char*, int, const char*, const char*, int, const char*)
+  {
+    usleep(20 * 1000);
+
+    return AssertAction::None;
+  }
+
+  TEST_F(AssertTest, serverMode)
+  {
+    // the default handler must not prompt, nor break
+    implementation::setAssertHandler(PPK_ASSERT_NULLPTR);
+    implementation::serverMode(true);
+    PPK_ASSERT_DEBUG(false, "nobody is going to answer");
+    implementation::serverMode(false);
+
+    implementation::HandlerTime before = implementation::handlerTime();
+    implementation::setAssertHandler(_slowHandler);
+    PPK_ASSERT_WARNING(false);
+    implementation::HandlerTime after = implementation::handlerTime();
+
+    EXPECT_EQ(before.calls + 1, after.calls);
+    EXPECT_LE(before.total + 20 * 1000, after.total);
+    EXPECT_LE(20 * 1000, after.max);
+  }
+#endif
+
+  void* _suppressedThread(void* failed)
+  {
+    _line = 0;
+    PPK_ASSERT_WARNING(false);
+    *static_cast<bool*>(failed) = _line != 0;
+
+    return PPK_ASSERT_NULLPTR;
+  }
+
+  TEST_F(AssertTest, suppressScope)
+  {
+    {
+      implementation::SuppressScope all;
+      _line = 0;
+      PPK_ASSERT_ERROR(false);
+      EXPECT_EQ(0, _line);
+
+      {
+        // doesn't lower the enclosing scope's level
+        implementation::SuppressScope warnings(AssertLevel::Debug);
+        PPK_ASSERT_DEBUG(false);
+        EXPECT_EQ(0, _line);
+      }
+
+#if !defined(_WIN32)
+      // other threads aren't affected
+      bool failed = false;
+      pthread_t thread;
+      ASSERT_EQ(0, pthread_create(&thread, PPK_ASSERT_NULLPTR, _suppressedThread, &failed));
+      pthread_join(thread, PPK_ASSERT_NULLPTR);
+      EXPECT_TRUE(failed);
+#endif
+    }
+
+    {
+      implementation::SuppressScope warnings(AssertLevel::Debug);
+      _line = 0;
+      PPK_ASSERT_WARNING(false);
+      EXPECT_EQ(0, _line);
+
+      PPK_ASSERT_DEBUG(false);
+      EXPECT_EQ(PPK_ASSERT_LINE - 1, _line);
+    }
+
+    // FATAL failures are only suppressed explicitly
+    {
+      implementation::SuppressScope all;
+      _line = 0;
+      PPK_ASSERT_FATAL(false);
+      EXPECT_EQ(PPK_ASSERT_LINE - 1, _line);
+    }
+
+    {
+      implementation::SuppressScope everything(INT_MAX);
+      _line = 0;
+      PPK_ASSERT_FATAL(false);
+      EXPECT_EQ(0, _line);
+    }
+
+    EXPECT_EQ(0, implementation::suppressLevel());
+    PPK_ASSERT_WARNING(false);
+    EXPECT_EQ(PPK_ASSERT_LINE - 1, _line);
+  }
+
+  int _scopedCalls = 0;
+
+  AssertAction::AssertAction _scopedHandler(const char*, int, const char*, const char*, int, const char*)
+  {
+    ++_scopedCalls;
+
+    return AssertAction::None;
+  }
+
+  void* _globalHandlerThread(void* line)
+  {
+    PPK_ASSERT_WARNING(false);
+    *static_cast<int*>(line) = _line;
+
+    return PPK_ASSERT_NULLPTR;
+  }
+
+  TEST_F(AssertTest, handlerScope)
+  {
+    _line = 0;
+
+    {
+      implementation::HandlerScope scope(_scopedHandler);
+      PPK_ASSERT_WARNING(false);
+      EXPECT_EQ(1, _scopedCalls);
+      EXPECT_EQ(0, _line);
+
+#if !defined(_WIN32)
+      // other threads still use the global handler
+      int line = 0;
+      pthread_t thread;
+      ASSERT_EQ(0, pthread_create(&thread, PPK_ASSERT_NULLPTR, _globalHandlerThread, &line));
+      pthread_join(thread, PPK_ASSERT_NULLPTR);
+      EXPECT_NE(0, line);
+      _line = 0;
+#endif
+
+      {
+        implementation::HandlerScope nested(_testHandler);
+        PPK_ASSERT_WARNING(false);
+        EXPECT_EQ(PPK_ASSERT_LINE - 1, _line);
+      }
+
+      PPK_ASSERT_WARNING(false);
+      EXPECT_EQ(2, _scopedCalls);
+    }
+
+    PPK_ASSERT_WARNING(false);
+    EXPECT_EQ(2, _scopedCalls);
+    EXPECT_EQ(PPK_ASSERT_LINE - 2, _line);
+  }
+
+  void PPK_ASSERT_CALL _countingSubscriber(const implementation::EventRecord& event, void* context)
+  {
+    if (strcmp(event.expression, "false") == 0)
+      ++*static_cast<int*>(context);
+
+    // would wait for itself
+    EXPECT_FALSE(implementation::unsubscribe(_countingSubscriber, context));
+  }
+
+#if !defined(_WIN32)
+  volatile bool _failing = false;
+
+  void* _failingThread(void*)
+  {
+    while (_failing)
+      PPK_ASSERT_WARNING(false);
+
+    return PPK_ASSERT_NULLPTR;
+  }
+#endif
+
+  TEST_F(AssertTest, subscribers)
+  {
+    int first = 0;
+    int second = 0;
+
+    ASSERT_TRUE(implementation::subscribe(_countingSubscriber, &first));
+    ASSERT_TRUE(implementation::subscribe(_countingSubscriber, &second));
+
+    PPK_ASSERT_WARNING(false);
+    EXPECT_EQ(1, first);
+    EXPECT_EQ(1, second);
+    EXPECT_EQ(PPK_ASSERT_LINE - 3, _line); // the handler is still called
+
+    EXPECT_TRUE(implementation::unsubscribe(_countingSubscriber, &first));
+    EXPECT_FALSE(implementation::unsubscribe(_countingSubscriber, &first));
+
+    PPK_ASSERT_WARNING(false);
+    EXPECT_EQ(1, first);
+    EXPECT_EQ(2, second);
+
+#if !defined(_WIN32)
+    // while assertions fail on another thread
+    _failing = true;
+    pthread_t thread;
+    ASSERT_EQ(0, pthread_create(&thread, PPK_ASSERT_NULLPTR, _failingThread, PPK_ASSERT_NULLPTR));
+
+    for (int i = 0; i < 100; ++i)
+    {
+      EXPECT_TRUE(implementation::subscribe(_countingSubscriber, &first));
+      EXPECT_TRUE(implementation::unsubscribe(_countingSubscriber, &first));
+    }
+
+    _failing = false;
+    pthread_join(thread, PPK_ASSERT_NULLPTR);
+#endif
+
+    EXPECT_TRUE(implementation::unsubscribe(_countingSubscriber, &second));
+  }
+
+#if !defined(_WIN32)
+  TEST_F(AssertTest, asyncDispatch)
+  {
+    ASSERT_TRUE(implementation::startAsyncDispatch());
+    EXPECT_FALSE(implementation::startAsyncDispatch());
+
+    {
+      // thread handlers are called synchronously, on the failing thread
+      implementation::HandlerScope scope(_scopedHandler);
+      _scopedCalls = 0;
+      unsigned long count = implementation::dispatchLatency().count;
+      PPK_ASSERT_WARNING(false, "scoped");
+      EXPECT_EQ(1, _scopedCalls);
+      EXPECT_EQ(count, implementation::dispatchLatency().count);
+    }
+
+    implementation::HandlerTime before = implementation::handlerTime();
+    implementation::setAssertHandler(_slowHandler);
+
+    // doesn't wait for the handler
+    unsigned long dispatched = 1;
+    PPK_ASSERT_WARNING(false);
+#if !defined(PPK_ASSERT_DISABLE_EXCEPTIONS)
+    EXPECT_THROW(PPK_ASSERT_ERROR(false), AssertionException);
+    ++dispatched;
+
+    // custom levels can be given their own policy
+    EXPECT_TRUE(implementation::setDispatchPolicy(AssertLevel::Warning + 1, AssertAction::Throw));
+    EXPECT_THROW(PPK_ASSERT_CUSTOM(AssertLevel::Warning + 1, false), AssertionException);
+    PPK_ASSERT_WARNING(false);
+    dispatched += 2;
+    EXPECT_TRUE(implementation::setDispatchPolicy(AssertLevel::Warning + 1, AssertAction::None));
+#endif
+    EXPECT_FALSE(implementation::setDispatchPolicy(AssertLevel::Debug, AssertAction::Break));
+
+    implementation::DispatchLatency latency = implementation::dispatchLatency();
+    EXPECT_EQ(dispatched, latency.count);
+    EXPECT_LT(latency.max, 20 * 1000);
+
+    // the queued events are handled before stopping
+    implementation::stopAsyncDispatch();
+    EXPECT_EQ(before.calls + dispatched, implementation::handlerTime().calls);
+    EXPECT_EQ(0u, implementation::droppedDispatchedEvents());
+
+    implementation::setAssertHandler(_testHandler);
+    PPK_ASSERT_WARNING(false);
+    EXPECT_EQ(PPK_ASSERT_LINE - 1, _line);
+    EXPECT_EQ(latency.count, implementation::dispatchLatency().count);
+  }
+#endif
+
+  uint64_t _correlation[PPK_ASSERT_CORRELATION_WORDS];
+
+  AssertAction::AssertAction _correlationHandler(const char*, int, const char*, const char*, int, const char*)
+  {
+    memcpy(_correlation, implementation::currentEvent()->correlation, sizeof(_correlation));
+
+    return AssertAction::None;
+  }
+
+  TEST_F(AssertTest, correlation)
+  {
+    EXPECT_EQ(static_cast<const implementation::EventRecord*>(PPK_ASSERT_NULLPTR), implementation::currentEvent());
+    implementation::setAssertHandler(_correlationHandler);
+
+    {
+      implementation::CorrelationScope request(0, 42);
+      implementation::CorrelationScope trace(1, UINT64_C(0xfedcba9876543210));
+      PPK_ASSERT_WARNING(false);
+      EXPECT_EQ(42u, _correlation[0]);
+      EXPECT_EQ(UINT64_C(0xfedcba9876543210), _correlation[1]);
+      EXPECT_EQ(0u, _correlation[2]);
+
+      {
+        implementation::CorrelationScope nested(0, 43);
+        PPK_ASSERT_WARNING(false);
+        EXPECT_EQ(43u, _correlation[0]);
+      }
+
+      EXPECT_EQ(42u, implementation::correlation(0));
+    }
+
+    PPK_ASSERT_WARNING(false);
+    EXPECT_EQ(0u, _correlation[0]);
+    EXPECT_EQ(0u, _correlation[1]);
+    EXPECT_EQ(static_cast<const implementation::EventRecord*>(PPK_ASSERT_NULLPTR), implementation::currentEvent());
+
+#if !defined(NDEBUG)
+    // the index is only checked in debug builds
+    EXPECT_DEATH_IF_SUPPORTED(implementation::setCorrelation(PPK_ASSERT_CORRELATION_WORDS, 1), "");
+    EXPECT_DEATH_IF_SUPPORTED(implementation::correlation(-1), "");
+#endif
+  }
+
+  void parseSection(const char* section, int line)
+  {
+    PPK_ASSERT_CONTEXT("reading section %s at line %d", section, line);
+    PPK_ASSERT_WARNING(false, "bad value %d", 42);
+  }
+
+  TEST_F(AssertTest, breadcrumbs)
+  {
+    {
+      char name[] = "config.json";
+      PPK_ASSERT_CONTEXT("parsing %s", name);
+
+      parseSection("net", 12);
+      EXPECT_STREQ("bad value 42 (while parsing config.json > reading section net at line 12)", _message);
+
+      PPK_ASSERT_WARNING(false);
+      EXPECT_STREQ("while parsing config.json", _message);
+
+      // the arguments are formatted with the types they were captured with
+      PPK_ASSERT_CONTEXT("%s %5.1f %x%% %q", 1, 2, 255u);
+      PPK_ASSERT_WARNING(false);
+      EXPECT_STREQ("while parsing config.json > ?   2.0 ff% %q", _message);
+    }
+
+    {
+      // 64-bit integers are long long on some platforms
+      PPK_ASSERT_CONTEXT("id %llu %lld %llx", UINT64_C(18446744073709551615), static_cast<implementation::LongLong>(-5), static_cast<implementation::UnsignedLongLong>(255));
+      PPK_ASSERT_WARNING(false, "wide");
+      EXPECT_STREQ("wide (while id 18446744073709551615 -5 ff)", _message);
+    }
+
+    PPK_ASSERT_WARNING(false, "no context");
+    EXPECT_STREQ("no context", _message);
+    EXPECT_EQ(static_cast<const implementation::Breadcrumb*>(PPK_ASSERT_NULLPTR), implementation::breadcrumbs());
+  }
+
+  uint64_t _taskId;
+
+  AssertAction::AssertAction _taskHandler(const char* file, int line, const char* function, const char* expression, int level, const char* message)
+  {
+    _taskId = implementation::currentEvent()->taskId;
+    memcpy(_correlation, implementation::currentEvent()->correlation, sizeof(_correlation));
+
+    return _testHandler(file, line, function, expression, level, message);
+  }
+
+#if !defined(_WIN32)
+  void* _resumeTask(void* context)
+  {
+    implementation::AssertContextScope scope(*static_cast<implementation::AssertContext*>(context));
+    PPK_ASSERT_WARNING(false);
+
+    return PPK_ASSERT_NULLPTR;
+  }
+#endif
+
+  TEST_F(AssertTest, assertContext)
+  {
+    implementation::setAssertHandler(_taskHandler);
+
+    // a task suspended with an open breadcrumb, e.g. in a coroutine frame
+    implementation::AssertContext task(7);
+    implementation::Breadcrumb* breadcrumb;
+
+    {
+      implementation::AssertContextScope scope(task);
+      implementation::setCorrelation(0, 99);
+      breadcrumb = new implementation::Breadcrumb("step %d", 1);
+
+      PPK_ASSERT_WARNING(false);
+      EXPECT_EQ(7u, _taskId);
+      EXPECT_EQ(99u, _correlation[0]);
+      EXPECT_STREQ("while step 1", _message);
+    }
+
+    // the thread's own context is back
+    PPK_ASSERT_WARNING(false, "no task");
+    EXPECT_EQ(0u, _taskId);
+    EXPECT_EQ(0u, _correlation[0]);
+    EXPECT_STREQ("no task", _message);
+
+#if !defined(_WIN32)
+    // resumed on another thread
+    pthread_t thread;
+    ASSERT_EQ(0, pthread_create(&thread, PPK_ASSERT_NULLPTR, _resumeTask, &task));
+    pthread_join(thread, PPK_ASSERT_NULLPTR);
+    EXPECT_EQ(7u, _taskId);
+    EXPECT_EQ(99u, _correlation[0]);
+    EXPECT_STREQ("while step 1", _message);
+#endif
+
+    {
+      implementation::AssertContextScope scope(task);
+      delete breadcrumb;
+    }
+
+    EXPECT_EQ(static_cast<const implementation::Breadcrumb*>(PPK_ASSERT_NULLPTR), task.breadcrumbs);
+    EXPECT_EQ(static_cast<const implementation::Breadcrumb*>(PPK_ASSERT_NULLPTR), implementation::breadcrumbs());
+  }
+
+#if !defined(_WIN32)
+  int64_t _eventTime;
+  uint64_t _eventThreadId;
+
+  AssertAction::AssertAction _clockHandler(const char* file, int line, const char* function, const char* expression, int level, const char* message)
+  {
+    _eventTime = implementation::currentEvent()->time;
+    _eventThreadId = implementation::currentEvent()->threadId;
+
+    return _testHandler(file, line, function, expression, level, message);
+  }
+
+  int64_t _wallClock()
+  {
+    struct timeval tv;
+    gettimeofday(&tv, PPK_ASSERT_NULLPTR);
+
+    return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+  }
+
+  TEST_F(AssertTest, eventClock)
+  {
+    implementation::setAssertHandler(_clockHandler);
+
+    // past the time stamp counter's calibration
+    usleep(120000);
+
+    for (int i = 0; i < 3; ++i)
+    {
+      int64_t before = _wallClock();
+      PPK_ASSERT_WARNING(false, "tick");
+      int64_t after = _wallClock();
+
+      // the interpolated clock agrees with the wall clock within a millisecond
+      EXPECT_LE(before - 1000, _eventTime);
+      EXPECT_GE(after + 1000, _eventTime);
+
+      usleep(10000);
+    }
+
+#if defined(__linux__)
+    EXPECT_EQ(static_cast<uint64_t>(syscall(SYS_gettid)), _eventThreadId);
+#endif
+  }
+#endif
+
+  TEST_F(AssertTest, stageLatency)
+  {
+    implementation::StageLatency total = implementation::stageLatency(AssertStage::Total, AssertLevel::Warning);
+    implementation::StageLatency handler = implementation::stageLatency(AssertStage::Handler, AssertLevel::Warning);
+
+    PPK_ASSERT_WARNING(false, "timed");
+
+    implementation::StageLatency totalAfter = implementation::stageLatency(AssertStage::Total, AssertLevel::Warning);
+    implementation::StageLatency handlerAfter = implementation::stageLatency(AssertStage::Handler, AssertLevel::Warning);
+    EXPECT_EQ(total.count + 1, totalAfter.count);
+    EXPECT_EQ(handler.count + 1, handlerAfter.count);
+    EXPECT_LE(handlerAfter.total - handler.total, totalAfter.total - total.total);
+
+    // custom levels are accounted with the standard level below them
+    EXPECT_EQ(totalAfter.count, implementation::stageLatency(AssertStage::Total, AssertLevel::Warning + 1).count);
+
+#if !defined(PPK_ASSERT_DISABLE_EXCEPTIONS)
+    unsigned long thrown = implementation::stageLatency(AssertStage::Throw, AssertLevel::Error).count;
+    EXPECT_THROW(PPK_ASSERT_ERROR(false, "timed"), AssertionException);
+    EXPECT_EQ(thrown + 1, implementation::stageLatency(AssertStage::Throw, AssertLevel::Error).count);
+#endif
+
+    EXPECT_EQ(3, implementation::latencyBucketBound(3));
+    EXPECT_EQ(4, implementation::latencyBucketBound(4));
+    EXPECT_EQ(8, implementation::latencyBucketBound(8));
+    EXPECT_EQ(10, implementation::latencyBucketBound(9));
+    EXPECT_EQ(64, implementation::latencyBucketBound(20));
+
+    implementation::StageLatency latency;
+    memset(&latency, 0, sizeof(latency));
+    latency.buckets[8] = 99;
+    latency.buckets[20] = 1;
+    latency.count = 100;
+    latency.max = 70;
+    EXPECT_EQ(9, implementation::latencyPercentile(latency, 50));
+    EXPECT_EQ(9, implementation::latencyPercentile(latency, 99));
+    EXPECT_EQ(70, implementation::latencyPercentile(latency, 100));
+
+#if !defined(_WIN32)
+    int pipes[2];
+    ASSERT_EQ(0, pipe(pipes));
+    implementation::dumpStageLatency(pipes[1]);
+    close(pipes[1]);
+
+    char buffer[16384];
+    ssize_t n = read(pipes[0], buffer, sizeof(buffer) - 1);
+    close(pipes[0]);
+    ASSERT_LT(0, n);
+    buffer[n] = 0;
+
+    EXPECT_TRUE(strstr(buffer, "WARNING handler count ") != PPK_ASSERT_NULLPTR);
+    EXPECT_TRUE(strstr(buffer, "WARNING total count ") != PPK_ASSERT_NULLPTR);
+#endif
+  }
+
   PPK_ASSERT_USED(bool) testBoolUsed()
   {
     return true;
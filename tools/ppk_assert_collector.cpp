@@ -0,0 +1,324 @@
+// see README.md for usage instructions.
+// (‑●‑●)> released under the WTFPL v2 license, by Gregory Pakosz (@gpakosz)
+
+// receives the failed assertions streamed by event shippers and appends them
+// to a file, see startEventShipper()
+
+#include <ppk_assert.h>
+#include "ppk_assert_tools.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+  namespace implementation = ppk::assert::implementation;
+  namespace tools = ppk::assert::tools;
+
+  struct Client
+  {
+    int fd;
+    bool greeted;
+    std::vector<unsigned char> buffer;
+  };
+
+  volatile sig_atomic_t _stop = 0;
+
+  void stop(int)
+  {
+    _stop = 1;
+  }
+
+  void usage(const char* program)
+  {
+    fprintf(stderr, "usage: %s [-o file] address\n", program);
+    fprintf(stderr, "  -o file  file the events are appended to (default: standard output)\n");
+    fprintf(stderr, "  address  path of a Unix domain socket, or host:port\n");
+  }
+
+  int listenTo(const char* address)
+  {
+    int fd = -1;
+
+    if (address[0] == '/')
+    {
+      struct sockaddr_un un;
+
+      if (strlen(address) >= sizeof(un.sun_path))
+        return -1;
+
+      memset(&un, 0, sizeof(un));
+      un.sun_family = AF_UNIX;
+      memcpy(un.sun_path, address, strlen(address));
+
+      unlink(address);
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+      if (fd >= 0 && bind(fd, reinterpret_cast<struct sockaddr*>(&un), sizeof(un)) != 0)
+      {
+        close(fd);
+        fd = -1;
+      }
+    }
+    else
+    {
+      std::vector<char> host(address, address + strlen(address) + 1);
+      char* port = strrchr(&host[0], ':');
+
+      if (!port)
+        return -1;
+
+      *port++ = 0;
+
+      struct addrinfo hints;
+      memset(&hints, 0, sizeof(hints));
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      hints.ai_flags = AI_PASSIVE;
+
+      struct addrinfo* addresses;
+
+      if (getaddrinfo(host[0] ? &host[0] : 0, port, &hints, &addresses) != 0)
+        return -1;
+
+      for (struct addrinfo* a = addresses; a && fd < 0; a = a->ai_next)
+      {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+
+        int one = 1;
+        if (fd >= 0 && (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 || bind(fd, a->ai_addr, a->ai_addrlen) != 0))
+        {
+          close(fd);
+          fd = -1;
+        }
+      }
+
+      freeaddrinfo(addresses);
+    }
+
+    if (fd >= 0 && listen(fd, 16) != 0)
+    {
+      close(fd);
+      fd = -1;
+    }
+
+    return fd;
+  }
+
+  uint64_t decodeInteger(const unsigned char*& p, int size)
+  {
+    uint64_t value = 0;
+
+    for (int i = 0; i < size; ++i)
+      value |= static_cast<uint64_t>(*p++) << (8 * i);
+
+    return value;
+  }
+
+  bool decodeString(const unsigned char*& p, const unsigned char* end, char* s, size_t size)
+  {
+    if (end - p < 2)
+      return false;
+
+    size_t length = static_cast<size_t>(decodeInteger(p, 2));
+
+    if (static_cast<size_t>(end - p) < length)
+      return false;
+
+    size_t copied = length < size ? length : size - 1;
+    memcpy(s, p, copied);
+    s[copied] = 0;
+    p += length;
+
+    return true;
+  }
+
+  bool decodeFrame(const unsigned char* p, const unsigned char* end, implementation::EventRecord& event)
+  {
+    if (end - p < 28 + 8 * PPK_ASSERT_CORRELATION_WORDS + 8)
+      return false;
+
+    memset(&event, 0, sizeof(event));
+    event.time = static_cast<int64_t>(decodeInteger(p, 8));
+    event.threadId = decodeInteger(p, 8);
+    event.processId = static_cast<int32_t>(decodeInteger(p, 4));
+    event.line = static_cast<int32_t>(decodeInteger(p, 4));
+    event.level = static_cast<int32_t>(decodeInteger(p, 4));
+
+    for (int i = 0; i < PPK_ASSERT_CORRELATION_WORDS; ++i)
+      event.correlation[i] = decodeInteger(p, 8);
+
+    event.taskId = decodeInteger(p, 8);
+
+    return decodeString(p, end, event.file, sizeof(event.file))
+        && decodeString(p, end, event.function, sizeof(event.function))
+        && decodeString(p, end, event.expression, sizeof(event.expression))
+        && decodeString(p, end, event.message, sizeof(event.message));
+  }
+
+  // returns false when the client must be disconnected
+  bool receive(Client& client, FILE* out)
+  {
+    unsigned char buffer[16384];
+    ssize_t n = recv(client.fd, buffer, sizeof(buffer), 0);
+
+    if (n < 0 && errno == EINTR)
+      return true;
+
+    if (n <= 0)
+      return false;
+
+    client.buffer.insert(client.buffer.end(), buffer, buffer + n);
+
+    size_t offset = 0;
+
+    if (!client.greeted)
+    {
+      if (client.buffer.size() < 8)
+        return true;
+
+      if (memcmp(&client.buffer[0], PPK_ASSERT_SHIPPER_MAGIC, 8) != 0)
+      {
+        fprintf(stderr, "unsupported shipper, disconnecting\n");
+        return false;
+      }
+
+      client.greeted = true;
+      offset = 8;
+    }
+
+    while (client.buffer.size() - offset >= 4)
+    {
+      const unsigned char* p = &client.buffer[offset];
+      size_t size = static_cast<size_t>(decodeInteger(p, 4));
+
+      if (client.buffer.size() - offset - 4 < size)
+        break;
+
+      implementation::EventRecord event;
+
+      if (!decodeFrame(p, p + size, event))
+      {
+        fprintf(stderr, "malformed frame, disconnecting\n");
+        return false;
+      }
+
+      tools::printEvent(out, event);
+      offset += 4 + size;
+    }
+
+    client.buffer.erase(client.buffer.begin(), client.buffer.begin() + static_cast<std::ptrdiff_t>(offset));
+
+    return true;
+  }
+
+}
+
+int main(int argc, char** argv)
+{
+  const char* output = 0;
+
+  int c;
+  while ((c = getopt(argc, argv, "o:h")) != -1)
+  {
+    switch (c)
+    {
+      case 'o':
+        output = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (optind + 1 != argc)
+  {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const char* address = argv[optind];
+  FILE* out = output ? fopen(output, "a") : stdout;
+
+  if (!out)
+  {
+    perror(output);
+    return EXIT_FAILURE;
+  }
+
+  int server = listenTo(address);
+
+  if (server < 0)
+  {
+    fprintf(stderr, "%s: can't listen\n", address);
+    return EXIT_FAILURE;
+  }
+
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  signal(SIGPIPE, SIG_IGN);
+
+  std::vector<Client> clients;
+
+  while (!_stop)
+  {
+    std::vector<struct pollfd> fds(1 + clients.size());
+    fds[0].fd = server;
+    fds[0].events = POLLIN;
+
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+      fds[1 + i].fd = clients[i].fd;
+      fds[1 + i].events = POLLIN;
+    }
+
+    if (poll(&fds[0], fds.size(), -1) < 0)
+      continue; // interrupted
+
+    for (size_t i = clients.size(); i > 0; --i)
+    {
+      if (fds[i].revents && !receive(clients[i - 1], out))
+      {
+        close(clients[i - 1].fd);
+        clients.erase(clients.begin() + static_cast<std::ptrdiff_t>(i - 1));
+      }
+    }
+
+    if (fds[0].revents)
+    {
+      Client client;
+      client.fd = accept(server, 0, 0);
+      client.greeted = false;
+
+      if (client.fd >= 0)
+        clients.push_back(client);
+    }
+
+    fflush(out);
+  }
+
+  for (size_t i = 0; i < clients.size(); ++i)
+    close(clients[i].fd);
+
+  close(server);
+
+  if (address[0] == '/')
+    unlink(address);
+
+  if (output)
+    fclose(out);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,169 @@
+# see README.md for usage instructions.
+# (‑●‑●)> released under the WTFPL v2 license, by Gregory Pakosz (@gpakosz)
+
+# gdb extension printing the last failed assertions and the most failing
+# assertion sites recorded by ppk_assert, from a live process or a core file:
+#
+#   (gdb) source tools/ppk_assert_gdb.py
+#   (gdb) ppk-assert [count]
+#
+# it only relies on the ppk_assert_journal symbol, see Journal in ppk_assert.h
+
+import struct
+import time
+
+MAGIC = b'PPKJRNL1'
+VERSION = 3
+
+LEVELS = {32: 'WARNING', 64: 'DEBUG', 128: 'ERROR', 256: 'FATAL'}
+
+JOURNAL = '8s16I'  # magic, then 16 uint32 fields, then 3 pointers
+
+# EventRecord
+EVENT = 'QqQiiii4QQ64s128s128s192s'
+
+
+def level_string(level):
+  return LEVELS.get(level, 'level = %d' % level)
+
+
+def c_string(data):
+  return data.split(b'\0', 1)[0].decode('utf-8', 'replace')
+
+
+class Journal(object):
+
+  def __init__(self, read, address):
+    self.read = read
+
+    magic = read(address, 8)
+    if magic != MAGIC:
+      raise ValueError('ppk_assert_journal not found, or corrupted')
+
+    # the version field tells the byte order apart
+    self.endian = '<' if struct.unpack('<I', read(address + 8, 4))[0] == VERSION else '>'
+
+    fields = struct.unpack(self.endian + JOURNAL, read(address, struct.calcsize('=' + JOURNAL)))
+    (_, version, self.pointer_size, self.long_size, self.event_count, self.event_stride,
+     self.event_sequence_offset, self.event_offset, self.site_count, self.site_stride,
+     self.site_ready_offset, self.site_file_offset, self.site_line_offset,
+     self.site_expression_offset, self.site_level_offset, self.site_failures_offset, _) = fields
+
+    if version != VERSION:
+      raise ValueError('unsupported journal version %d' % version)
+
+    pointers = address + struct.calcsize('=' + JOURNAL)
+    self.events = self.pointer(pointers)
+    self.event_head = self.pointer(pointers + self.pointer_size)
+    self.sites = self.pointer(pointers + 2 * self.pointer_size)
+
+  def integer(self, address, size, signed=False):
+    format = {4: 'i', 8: 'q'}[size]
+    return struct.unpack(self.endian + (format if signed else format.upper()), self.read(address, size))[0]
+
+  def pointer(self, address):
+    return self.integer(address, self.pointer_size)
+
+  def string(self, address, limit=256):
+    if not address:
+      return '(null)'
+
+    try:
+      return c_string(self.read(address, limit))
+    except Exception:
+      return '<unreadable @ 0x%x>' % address
+
+  # oldest first
+  def last_events(self, count):
+    head = self.integer(self.event_head, self.long_size, True)
+    events = []
+
+    for position in range(max(0, head - min(count, self.event_count)), head):
+      record = self.events + (position % self.event_count) * self.event_stride
+
+      if self.integer(record + self.event_sequence_offset, self.long_size, True) != position + 1:
+        continue  # being written when the process died
+
+      data = self.read(record + self.event_offset, struct.calcsize('=' + EVENT))
+      fields = struct.unpack(self.endian + EVENT, data)
+      (_, timestamp, thread, process, line, level, _) = fields[:7]
+      correlation = fields[7:11]
+      task = fields[11]
+      (file, function, expression, message) = fields[12:]
+      events.append({
+        'time': timestamp, 'thread': thread, 'process': process, 'line': line, 'level': level, 'task': task, 'correlation': correlation,
+        'file': c_string(file), 'function': c_string(function), 'expression': c_string(expression),
+        'message': c_string(message)})
+
+    return events
+
+  # by decreasing number of failures
+  def hottest_sites(self, count):
+    sites = []
+
+    for i in range(self.site_count):
+      site = self.sites + i * self.site_stride
+
+      if not self.integer(site + self.site_ready_offset, self.long_size):
+        continue
+
+      sites.append({
+        'file': self.string(self.pointer(site + self.site_file_offset)),
+        'line': self.integer(site + self.site_line_offset, 4, True),
+        'expression': self.string(self.pointer(site + self.site_expression_offset)),
+        'level': self.integer(site + self.site_level_offset, 4, True),
+        'failures': self.integer(site + self.site_failures_offset, self.long_size, True)})
+
+    sites.sort(key=lambda site: site['failures'], reverse=True)
+    return sites[:count]
+
+
+def report(journal, count, write):
+  write('last failed assertions:\n')
+
+  for event in journal.last_events(count):
+    write("%s.%06d [%d:%d] Assertion '%s' failed (%s) in file %s, line %d, function: %s%s%s%s\n" % (
+      time.strftime('%Y-%m-%d %H:%M:%S', time.gmtime(event['time'] // 1000000)), event['time'] % 1000000,
+      event['process'], event['thread'], event['expression'], level_string(event['level']), event['file'],
+      event['line'], event['function'], ', with message: ' + event['message'] if event['message'] else '',
+      ', task: %x' % event['task'] if event['task'] else '',
+      ', correlation: ' + ':'.join('%x' % word for word in event['correlation']) if any(event['correlation']) else ''))
+
+  write('\nmost failing assertion sites:\n')
+
+  for site in journal.hottest_sites(count):
+    write("%10d %8s  %s:%d '%s'\n" % (site['failures'], level_string(site['level']), site['file'], site['line'], site['expression']))
+
+
+try:
+  import gdb
+except ImportError:
+  gdb = None
+
+if gdb:
+
+  class PpkAssertCommand(gdb.Command):
+    """Print the last failed assertions and the most failing assertion sites.
+
+Usage: ppk-assert [count]"""
+
+    def __init__(self):
+      super(PpkAssertCommand, self).__init__('ppk-assert', gdb.COMMAND_DATA)
+
+    def invoke(self, argument, from_tty):
+      count = int(argument) if argument.strip() else 20
+
+      try:
+        address = int(gdb.parse_and_eval('(unsigned long)&ppk_assert_journal'))
+      except gdb.error:
+        address = int(gdb.parse_and_eval("(unsigned long)&'ppk::assert::implementation::ppk_assert_journal'"))
+
+      inferior = gdb.selected_inferior()
+      read = lambda address, size: inferior.read_memory(address, size).tobytes()
+
+      try:
+        report(Journal(read, address), count, gdb.write)
+      except ValueError as e:
+        raise gdb.GdbError(str(e))
+
+  PpkAssertCommand()
@@ -0,0 +1,223 @@
+// see README.md for usage instructions.
+// (‑●‑●)> released under the WTFPL v2 license, by Gregory Pakosz (@gpakosz)
+
+// prints the most failing assertion sites recorded in a statistics file or
+// shared memory segment, see openStatsFile() and openStatsSegment()
+
+#include <ppk_assert.h>
+#include "ppk_assert_tools.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+  namespace implementation = ppk::assert::implementation;
+  namespace tools = ppk::assert::tools;
+
+  struct Sample
+  {
+    uint64_t hash;
+    uint64_t failures;
+    uint64_t delta;
+    int64_t lastSeen;
+    int line;
+    int level;
+    char file[sizeof(implementation::StatsRecord().file)];
+    char expression[sizeof(implementation::StatsRecord().expression)];
+  };
+
+  bool operator < (const Sample& lhs, const Sample& rhs)
+  {
+    if (lhs.delta != rhs.delta)
+      return lhs.delta > rhs.delta;
+
+    return lhs.failures > rhs.failures;
+  }
+
+  void usage(const char* program)
+  {
+    fprintf(stderr, "usage: %s [-n count] [-i seconds] (-f file | -s segment)\n", program);
+    fprintf(stderr, "  -n count    number of sites to print (default: 20)\n");
+    fprintf(stderr, "  -i seconds  refresh interval, print once when omitted\n");
+    fprintf(stderr, "  -f file     statistics file, see openStatsFile()\n");
+    fprintf(stderr, "  -s segment  shared memory segment, see openStatsSegment()\n");
+  }
+
+  const implementation::StatsHeader* map(const char* file, const char* segment)
+  {
+    int fd = file ? open(file, O_RDONLY) : shm_open(segment, O_RDONLY, 0);
+
+    if (fd < 0)
+    {
+      perror(file ? file : segment);
+      return 0;
+    }
+
+    struct stat st;
+    void* p = MAP_FAILED;
+
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(implementation::StatsHeader))
+      p = mmap(0, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (p == MAP_FAILED)
+    {
+      fprintf(stderr, "%s: can't map statistics\n", file ? file : segment);
+      return 0;
+    }
+
+    const implementation::StatsHeader* header = static_cast<const implementation::StatsHeader*>(p);
+    size_t size = sizeof(implementation::StatsHeader) + header->capacity * sizeof(implementation::StatsRecord);
+
+    if (memcmp(header->magic, PPK_ASSERT_STATS_MAGIC, sizeof(header->magic)) != 0 || header->version != PPK_ASSERT_STATS_VERSION || size > static_cast<size_t>(st.st_size))
+    {
+      fprintf(stderr, "%s: unsupported statistics layout\n", file ? file : segment);
+      return 0;
+    }
+
+    return header;
+  }
+
+  void snapshot(const implementation::StatsHeader* header, const std::vector<Sample>& previous, std::vector<Sample>& samples)
+  {
+    const implementation::StatsRecord* records = reinterpret_cast<const implementation::StatsRecord*>(header + 1);
+
+    samples.clear();
+
+    for (uint32_t i = 0; i < header->capacity; ++i)
+    {
+      const implementation::StatsRecord& record = records[i];
+
+      Sample sample;
+      sample.hash = __atomic_load_n(&record.hash, __ATOMIC_ACQUIRE);
+
+      if (!sample.hash)
+        continue;
+
+      sample.failures = __atomic_load_n(&record.failures, __ATOMIC_RELAXED);
+      sample.lastSeen = __atomic_load_n(&record.lastSeen, __ATOMIC_RELAXED);
+      sample.line = record.line;
+      sample.level = record.level;
+      memcpy(sample.file, record.file, sizeof(sample.file));
+      memcpy(sample.expression, record.expression, sizeof(sample.expression));
+      sample.file[sizeof(sample.file) - 1] = 0;
+      sample.expression[sizeof(sample.expression) - 1] = 0;
+
+      sample.delta = 0;
+      for (size_t j = 0; j < previous.size(); ++j)
+      {
+        if (previous[j].hash == sample.hash)
+        {
+          sample.delta = sample.failures - previous[j].failures;
+          break;
+        }
+      }
+
+      samples.push_back(sample);
+    }
+
+    std::sort(samples.begin(), samples.end());
+  }
+
+  void report(const implementation::StatsHeader* header, const std::vector<Sample>& samples, size_t count, bool live)
+  {
+    time_t now = time(0);
+
+    printf("%10s %10s %8s %9s  %s\n", "FAILURES", live ? "DELTA" : "", "LEVEL", "LAST SEEN", "SITE");
+
+    for (size_t i = 0; i < samples.size() && i < count; ++i)
+    {
+      const Sample& sample = samples[i];
+      char level[32];
+      char delta[24] = "";
+
+      if (live)
+        snprintf(delta, sizeof(delta), "+%llu", static_cast<unsigned long long>(sample.delta));
+
+      printf("%10llu %10s %8s %8llds  %s:%d '%s'\n", static_cast<unsigned long long>(sample.failures), delta,
+             tools::levelString(sample.level, level, sizeof(level)), static_cast<long long>(now - sample.lastSeen),
+             sample.file, sample.line, sample.expression);
+    }
+
+    if (uint64_t overflow = __atomic_load_n(&header->overflow, __ATOMIC_RELAXED))
+      printf("%10llu failures not recorded, the table is full\n", static_cast<unsigned long long>(overflow));
+
+    fflush(stdout);
+  }
+
+}
+
+int main(int argc, char** argv)
+{
+  const char* file = 0;
+  const char* segment = 0;
+  size_t count = 20;
+  int interval = 0;
+
+  int c;
+  while ((c = getopt(argc, argv, "n:i:f:s:h")) != -1)
+  {
+    switch (c)
+    {
+      case 'n':
+        count = static_cast<size_t>(atoi(optarg));
+        break;
+      case 'i':
+        interval = atoi(optarg);
+        break;
+      case 'f':
+        file = optarg;
+        break;
+      case 's':
+        segment = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (!file == !segment)
+  {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const implementation::StatsHeader* header = map(file, segment);
+
+  if (!header)
+    return EXIT_FAILURE;
+
+  std::vector<Sample> previous;
+  std::vector<Sample> samples;
+
+  snapshot(header, previous, samples);
+
+  if (interval <= 0)
+  {
+    report(header, samples, count, false);
+    return EXIT_SUCCESS;
+  }
+
+  for (;;)
+  {
+    printf("\033[H\033[2J");
+    report(header, samples, count, true);
+
+    sleep(static_cast<unsigned int>(interval));
+
+    previous.swap(samples);
+    snapshot(header, previous, samples);
+  }
+}
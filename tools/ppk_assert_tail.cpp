@@ -0,0 +1,203 @@
+// see README.md for usage instructions.
+// (‑●‑●)> released under the WTFPL v2 license, by Gregory Pakosz (@gpakosz)
+
+// prints the failed assertions published to a shared memory segment, see
+// openEventSegment()
+
+#include <ppk_assert.h>
+#include "ppk_assert_tools.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+  namespace implementation = ppk::assert::implementation;
+  namespace tools = ppk::assert::tools;
+
+  bool earlier(const implementation::EventRecord& lhs, const implementation::EventRecord& rhs)
+  {
+    return lhs.time < rhs.time;
+  }
+
+  void usage(const char* program)
+  {
+    fprintf(stderr, "usage: %s [-n count] [-f] segment\n", program);
+    fprintf(stderr, "  -n count  number of past events to print first (default: 10)\n");
+    fprintf(stderr, "  -f        keep printing events as they are published\n");
+  }
+
+  const implementation::EventsHeader* map(const char* segment)
+  {
+    int fd = shm_open(segment, O_RDONLY, 0);
+
+    if (fd < 0)
+    {
+      perror(segment);
+      return 0;
+    }
+
+    struct stat st;
+    void* p = MAP_FAILED;
+
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(implementation::EventsHeader))
+      p = mmap(0, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (p == MAP_FAILED)
+    {
+      fprintf(stderr, "%s: can't map events\n", segment);
+      return 0;
+    }
+
+    const implementation::EventsHeader* header = static_cast<const implementation::EventsHeader*>(p);
+    size_t ring = offsetof(implementation::EventRing, records) + header->ringSize * sizeof(implementation::EventRecord);
+    size_t size = sizeof(implementation::EventsHeader) + header->rings * ring;
+
+    if (memcmp(header->magic, PPK_ASSERT_EVENTS_MAGIC, sizeof(header->magic)) != 0 || header->version != PPK_ASSERT_EVENTS_VERSION
+     || header->recordSize != sizeof(implementation::EventRecord) || header->ringSize & (header->ringSize - 1) || size > static_cast<size_t>(st.st_size))
+    {
+      fprintf(stderr, "%s: unsupported events layout\n", segment);
+      return 0;
+    }
+
+    return header;
+  }
+
+  const implementation::EventRing& ring(const implementation::EventsHeader* header, uint32_t i)
+  {
+    size_t size = offsetof(implementation::EventRing, records) + header->ringSize * sizeof(implementation::EventRecord);
+    return *reinterpret_cast<const implementation::EventRing*>(reinterpret_cast<const char*>(header + 1) + i * size);
+  }
+
+  // seqlock protocol, fails if the record is being overwritten
+  bool readEvent(const implementation::EventsHeader* header, const implementation::EventRing& ring, uint64_t position, implementation::EventRecord& event)
+  {
+    const implementation::EventRecord& record = ring.records[position & (header->ringSize - 1)];
+
+    if (__atomic_load_n(&record.sequence, __ATOMIC_ACQUIRE) != position + 1)
+      return false;
+
+    memcpy(&event, &record, sizeof(event));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(&record.sequence, __ATOMIC_RELAXED) != position + 1)
+      return false;
+
+    event.file[sizeof(event.file) - 1] = 0;
+    event.function[sizeof(event.function) - 1] = 0;
+    event.expression[sizeof(event.expression) - 1] = 0;
+    event.message[sizeof(event.message) - 1] = 0;
+
+    return true;
+  }
+
+  // reads events from positions up to the head of each ring, returns the
+  // number of events that were overwritten before they could be read
+  uint64_t pollEvents(const implementation::EventsHeader* header, std::vector<uint64_t>& positions, std::vector<implementation::EventRecord>& events)
+  {
+    uint64_t lost = 0;
+
+    for (uint32_t i = 0; i < header->rings; ++i)
+    {
+      const implementation::EventRing& r = ring(header, i);
+      uint64_t head = __atomic_load_n(&r.head, __ATOMIC_ACQUIRE);
+      uint64_t& position = positions[i];
+
+      if (head < position) // the segment was reinitialized
+        position = head;
+
+      if (head - position > header->ringSize)
+      {
+        lost += head - header->ringSize - position;
+        position = head - header->ringSize;
+      }
+
+      for (; position < head; ++position)
+      {
+        implementation::EventRecord event;
+
+        if (readEvent(header, r, position, event))
+          events.push_back(event);
+        else
+          ++lost;
+      }
+    }
+
+    std::stable_sort(events.begin(), events.end(), earlier);
+
+    return lost;
+  }
+
+}
+
+int main(int argc, char** argv)
+{
+  size_t count = 10;
+  bool follow = false;
+
+  int c;
+  while ((c = getopt(argc, argv, "n:fh")) != -1)
+  {
+    switch (c)
+    {
+      case 'n':
+        count = static_cast<size_t>(atoi(optarg));
+        break;
+      case 'f':
+        follow = true;
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (optind + 1 != argc)
+  {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const implementation::EventsHeader* header = map(argv[optind]);
+
+  if (!header)
+    return EXIT_FAILURE;
+
+  std::vector<uint64_t> positions(header->rings, 0);
+  std::vector<implementation::EventRecord> events;
+
+  pollEvents(header, positions, events);
+
+  for (size_t i = events.size() > count ? events.size() - count : 0; i < events.size(); ++i)
+    tools::printEvent(stdout, events[i]);
+
+  fflush(stdout);
+
+  while (follow)
+  {
+    usleep(100 * 1000);
+
+    events.clear();
+
+    if (uint64_t lost = pollEvents(header, positions, events))
+      fprintf(stderr, "-- %llu events lost --\n", static_cast<unsigned long long>(lost));
+
+    for (size_t i = 0; i < events.size(); ++i)
+      tools::printEvent(stdout, events[i]);
+
+    fflush(stdout);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+// see README.md for usage instructions.
+// (‑●‑●)> released under the WTFPL v2 license, by Gregory Pakosz (@gpakosz)
+
+// formatting shared by the tools printing failed assertions, so that
+// ppk_assert_tail, ppk_assert_collector and ppk_assert_stats print events
+// and levels the same way
+
+#if !defined(PPK_ASSERT_TOOLS_H)
+#define PPK_ASSERT_TOOLS_H
+
+#include <ppk_assert.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <ctime>
+
+namespace ppk {
+namespace assert {
+namespace tools {
+
+  inline const char* levelString(int level, char* buffer, size_t size)
+  {
+    switch (level)
+    {
+      case implementation::AssertLevel::Warning:
+        return "WARNING";
+      case implementation::AssertLevel::Debug:
+        return "DEBUG";
+      case implementation::AssertLevel::Error:
+        return "ERROR";
+      case implementation::AssertLevel::Fatal:
+        return "FATAL";
+      default:
+        snprintf(buffer, size, "level = %d", level);
+        return buffer;
+    }
+  }
+
+  // ", task: " followed by the task id, then ", correlation: " followed by
+  // the correlation words, each only when set
+  inline const char* contextString(const implementation::EventRecord& event, char* buffer, size_t size)
+  {
+    bool set = false;
+
+    for (int i = 0; i < PPK_ASSERT_CORRELATION_WORDS; ++i)
+      set = set || event.correlation[i] != 0;
+
+    char* p = buffer;
+    char* end = buffer + size;
+    *p = 0;
+
+    if (event.taskId)
+    {
+      int n = snprintf(p, static_cast<size_t>(end - p), ", task: %llx", static_cast<unsigned long long>(event.taskId));
+      p += n > 0 ? n : 0;
+    }
+
+    for (int i = 0; set && i < PPK_ASSERT_CORRELATION_WORDS && p < end; ++i)
+    {
+      int n = snprintf(p, static_cast<size_t>(end - p), i ? ":%llx" : ", correlation: %llx", static_cast<unsigned long long>(event.correlation[i]));
+      p += n > 0 ? n : 0;
+    }
+
+    return buffer;
+  }
+
+  inline void printEvent(FILE* out, const implementation::EventRecord& event)
+  {
+    time_t seconds = static_cast<time_t>(event.time / 1000000);
+    struct tm tm;
+    char time[32];
+    char level[32];
+    char context[160];
+
+    strftime(time, sizeof(time), "%Y-%m-%d %H:%M:%S", localtime_r(&seconds, &tm));
+
+    fprintf(out, "%s.%06d [%d:%llu] Assertion '%s' failed (%s) in file %s, line %d, function: %s%s%s%s\n",
+            time, static_cast<int>(event.time % 1000000), event.processId, static_cast<unsigned long long>(event.threadId),
+            event.expression, levelString(event.level, level, sizeof(level)), event.file, event.line, event.function,
+            event.message[0] ? ", with message: " : "", event.message,
+            contextString(event, context, sizeof(context)));
+  }
+
+} // namespace tools
+} // namespace assert
+} // namespace ppk
+
+#endif